@@ -1,9 +1,18 @@
+#include <limits.h>
 #include "assembly.h"
+#include "regalloc.h"
+#include "optimize.h"
 
 #define debug_assem(a)   // printf(a)
 #define debug_call(a)    // printf(a)
 #define debug_devide(fw) // fprintf(fw, "\n\n")
 
+__thread pRegisters registers = nullptr;
+__thread pVarTable varTable = nullptr;
+
+// Placeholder operand for registers that only hold values inside one instruction.
+static Operand copyTmp = {OP_CONSTANT, {0}, nullptr, 4, false};
+
 const char *REG_NAME[REG_NUM] = {
     "$0", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3", "$t0", "$t1", "$t2",
     "$t3", "$t4", "$t5", "$t6", "$t7", "$s0", "$s1", "$s2", "$s3", "$s4", "$s5",
@@ -27,6 +36,15 @@ void resetRegisters(pRegisters registers)
     for (int i = 1; i < REG_NUM; i++)
     {
         registers->regList[i]->isFree = true;
+        registers->regList[i]->isDirty = false;
+    }
+}
+
+void unlockRegisters(pRegisters registers)
+{
+    for (int i = 0; i < REG_NUM; i++)
+    {
+        registers->regList[i]->isLocked = false;
     }
 }
 
@@ -46,7 +64,33 @@ pVarTable newVarTable()
     assert(p != nullptr);
     p->varListReg = newAssemVarList();
     p->varListMem = newAssemVarList();
-    p->sp = 0;
+    p->varListArray = newAssemVarList();
+    p->varListAlloc = newAssemVarList();
+    p->varListSlot = newAssemVarList();
+    p->slotColor = nullptr;
+    p->slotNum = 0;
+    p->slotLive = nullptr;
+    p->slotWords = 0;
+    p->callSaveMask = nullptr;
+    p->callNo = 0;
+    p->isFoldedAddr = nullptr;
+    p->codeNo = 0;
+    p->hasPending = false;
+    p->pendingBase = nullptr;
+    p->pendingOffset = 0;
+    for (int i = 0; i < REG_NUM; i++)
+    {
+        p->saveSlot[i] = -1;
+        p->isHoisted[i] = false;
+    }
+    p->frameSize = 0;
+    p->saveBase = 0;
+    p->raSlot = 0;
+    p->isLeaf = true;
+    p->funcName = nullptr;
+    p->copyNo = 0;
+    p->labelRef = nullptr;
+    p->selectNum = 0;
     return p;
 }
 
@@ -55,9 +99,19 @@ void deleteVarTable(pVarTable varTable)
     assert(varTable != nullptr);
     clearAssemVarList(varTable->varListReg);
     clearAssemVarList(varTable->varListMem);
+    clearAssemVarList(varTable->varListArray);
+    clearAssemVarList(varTable->varListAlloc);
+    clearAssemVarList(varTable->varListSlot);
     free(varTable->varListReg);
     free(varTable->varListMem);
-    varTable->sp = 0;
+    free(varTable->varListArray);
+    free(varTable->varListAlloc);
+    free(varTable->varListSlot);
+    free(varTable->slotColor);
+    free(varTable->slotLive);
+    free(varTable->callSaveMask);
+    free(varTable->isFoldedAddr);
+    free(varTable->labelRef);
     free(varTable);
 }
 
@@ -67,6 +121,10 @@ pAssemVarList newAssemVarList()
     assert(p != nullptr);
     p->head = nullptr;
     p->cur = nullptr;
+    for (int i = 0; i < VAR_HASH_SIZE; i++)
+    {
+        p->hash[i] = nullptr;
+    }
     return p;
 }
 
@@ -100,30 +158,75 @@ void addVariable(pAssemVarList varList, int regNo, pOperand op)
     {
         assert(varList->cur != nullptr);
         varList->cur->next = newVar;
+        newVar->prev = varList->cur;
     }
     varList->cur = newVar;
+    // Keep the first variable of a name found first, as the list order does.
+    unsigned int idx = getVarHashCode(op);
+    pVariable *slot = &varList->hash[idx];
+    while (*slot != nullptr)
+        slot = &(*slot)->nextHash;
+    *slot = newVar;
 }
 
-void removeVariable(pAssemVarList varList, pVariable var)
+pVariable searchVariable(pAssemVarList varList, pOperand op)
+{
+    assert(op->kind != OP_CONSTANT);
+    pVariable tmp = varList->hash[getVarHashCode(op)];
+    while (tmp != nullptr)
+    {
+        if (tmp->op->kind != OP_CONSTANT && !strcmp(tmp->op->u.name, op->u.name))
+            return tmp;
+        tmp = tmp->nextHash;
+    }
+    return nullptr;
+}
+
+pVariable searchConstant(pAssemVarList varList, int value)
+{
+    // Constants all hash to the same bucket, scratch registers hold no constant.
+    assert(value != 0);
+    pVariable tmp = varList->hash[getVarHashCode(&copyTmp)];
+    while (tmp != nullptr)
+    {
+        if (tmp->op->kind == OP_CONSTANT && tmp->op != &copyTmp && tmp->op->u.value == value)
+            return tmp;
+        tmp = tmp->nextHash;
+    }
+    return nullptr;
+}
+
+int getHoistedReg(pVarTable varTable, int value)
 {
-    if (var == varList->head)
+    // The register value is hoisted to, -1 if there is none.
+    for (int i = 0; i < REG_NUM; i++)
     {
-        varList->head = varList->head->next;
+        if (varTable->isHoisted[i] && varTable->hoistedValue[i] == value)
+            return i;
     }
+    return -1;
+}
+
+void removeVariable(pAssemVarList varList, pVariable var)
+{
+    if (var->prev != nullptr)
+        var->prev->next = var->next;
     else
+        varList->head = var->next;
+    if (var->next != nullptr)
+        var->next->prev = var->prev;
+    if (varList->cur == var)
+        varList->cur = var->prev;
+    pVariable *slot = &varList->hash[getVarHashCode(var->op)];
+    while (*slot != var)
     {
-        pVariable tmp = varList->head;
-        while (tmp != nullptr)
-        {
-            if (tmp->next == var)
-                break;
-            tmp = tmp->next;
-        }
-        if (varList->cur == var)
-            varList->cur = tmp;
-        tmp->next = var->next;
+        assert(*slot != nullptr);
+        slot = &(*slot)->nextHash;
     }
+    *slot = var->nextHash;
+    var->prev = nullptr;
     var->next = nullptr;
+    var->nextHash = nullptr;
 }
 
 void delVariable(pAssemVarList varList, pVariable var)
@@ -140,33 +243,40 @@ void clearAssemVarList(pAssemVarList varList)
     {
         pVariable p = tmp;
         tmp = tmp->next;
+        varList->hash[getVarHashCode(p->op)] = nullptr;
         free(p);
     }
     varList->head = nullptr;
     varList->cur = nullptr;
 }
 
-int checkVariable(FILE *fp, pVarTable varTable, pRegisters registers, pOperand op)
+int checkVariable(pVarTable varTable, pRegisters registers, pOperand op)
 {
     assert(op != nullptr);
     if (op->kind != OP_CONSTANT)
     {
-        int regNo = allocReg(registers, varTable, op, fp);
-        pVariable memTmp = varTable->varListMem->head;
-        while (memTmp != nullptr)
+        pVariable allocated = searchVariable(varTable->varListAlloc, op);
+        if (allocated != nullptr)
+            return allocated->index;
+        // Reuse the register loaded or defined earlier in this block.
+        pVariable cached = searchVariable(varTable->varListReg, op);
+        if (cached != nullptr)
         {
-            assert(memTmp->op->kind != OP_CONSTANT);
-            if (!strcmp(memTmp->op->u.name, op->u.name))
-            {
-                assert((memTmp->index < 0 || memTmp->index >= 8) && memTmp->index % 4 == 0);
-                fprintf(fp, "  lw %s, %d($gp)\n", registers->regList[regNo]->name, memTmp->index);
-                return regNo;
-            }
-            memTmp = memTmp->next;
+            registers->regList[cached->index]->isLocked = true;
+            return cached->index;
         }
-        if(memTmp == nullptr){
-            assert(0); // allocate space in IR_FUNCTION
+        int regNo = allocReg(registers, varTable, op);
+        // The name of a local array or structure stands for its address.
+        pVariable array = searchVariable(varTable->varListArray, op);
+        if (array != nullptr)
+        {
+            emitCode("  addi %s, $sp, %d\n", registers->regList[regNo]->name, array->index);
+            return regNo;
         }
+        pVariable memTmp = searchVariable(varTable->varListMem, op);
+        assert(memTmp != nullptr); // allocate space in IR_FUNCTION
+        assert(memTmp->index >= 0 && memTmp->index % 4 == 0);
+        emitCode("  lw %s, %d($sp)\n", registers->regList[regNo]->name, memTmp->index);
         return regNo;
     }
     else
@@ -174,15 +284,40 @@ int checkVariable(FILE *fp, pVarTable varTable, pRegisters registers, pOperand o
         // For an intermediate, allocate a reg for it; if it is 0, return $0.
         if (op->u.value == 0)
             return ZERO;
-        pVariable tmp = varTable->varListReg->head;
-        // always allocate a new reg for intermediate, otherwise inside a loop, program may go wrong.
-        int regNo = allocReg(registers, varTable, op, fp);
-        fprintf(fp, "  li %s, %d\n", registers->regList[regNo]->name, op->u.value);
+        int hoisted = getHoistedReg(varTable, op->u.value);
+        if (hoisted >= 0)
+            return hoisted;
+        // The register descriptor is forgotten at every label, so a constant loaded in this block
+        // is still there.
+        pVariable cached = searchConstant(varTable->varListReg, op->u.value);
+        if (cached != nullptr)
+        {
+            registers->regList[cached->index]->isLocked = true;
+            return cached->index;
+        }
+        int regNo = allocReg(registers, varTable, op);
+        emitCode("  li %s, %d\n", registers->regList[regNo]->name, op->u.value);
         return regNo;
     }
 }
 
-int allocReg(pRegisters registers, pVarTable varTable, pOperand op, FILE *fp)
+int defineVariable(pVarTable varTable, pRegisters registers, pOperand op)
+{
+    // The register to put a new value of op in, its old value is not loaded.
+    assert(op != nullptr && op->kind != OP_CONSTANT);
+    pVariable allocated = searchVariable(varTable->varListAlloc, op);
+    if (allocated != nullptr)
+        return allocated->index;
+    pVariable cached = searchVariable(varTable->varListReg, op);
+    if (cached != nullptr)
+    {
+        registers->regList[cached->index]->isLocked = true;
+        return cached->index;
+    }
+    return allocReg(registers, varTable, op);
+}
+
+int allocReg(pRegisters registers, pVarTable varTable, pOperand op)
 {
     // If there are free regs, use them first.
     for (int i = T0; i <= T9; i++)
@@ -190,6 +325,7 @@ int allocReg(pRegisters registers, pVarTable varTable, pOperand op, FILE *fp)
         if (registers->regList[i]->isFree)
         {
             registers->regList[i]->isFree = false;
+            registers->regList[i]->isLocked = true;
             addVariable(varTable->varListReg, i, op);
             return i;
         }
@@ -200,34 +336,46 @@ int allocReg(pRegisters registers, pVarTable varTable, pOperand op, FILE *fp)
     while (tmp != nullptr)
     {
         if (tmp->op->kind == OP_CONSTANT &&
-            tmp->index != registers->lastchangedNo)
+            tmp->index != registers->lastchangedNo &&
+            !registers->regList[tmp->index]->isLocked)
         {
             int regNo = tmp->index;
             registers->lastchangedNo = regNo;
+            registers->regList[regNo]->isLocked = true;
             delVariable(varTable->varListReg, tmp);
             addVariable(varTable->varListReg, regNo, op);
             return regNo;
         }
         tmp = tmp->next;
     }
-    // if no such intermediates, free a recently-not-used temporary variable
-    tmp = varTable->varListReg->head;
-    while (tmp != nullptr)
+    // if no such intermediates, free a recently-not-used temporary variable,
+    // a clean one first since its stack slot is up to date.
+    for (int pass = 0; pass < 2; pass++)
     {
-        // The temporary variable: 't' + number
-        // The defined variable: 't_' + name
-        // The arrays as global variable: '_t_' + name
-        // The parameters: 'v_' + name
-        if (tmp->op->kind != OP_CONSTANT && tmp->index != registers->lastchangedNo)
+        tmp = varTable->varListReg->head;
+        while (tmp != nullptr)
         {
+            // The temporary variable: 't' + number
+            // The defined variable: 't_' + name
+            // The arrays as global variable: '_t_' + name
+            // The parameters: 'v_' + name
             int regNo = tmp->index;
-            registers->lastchangedNo = regNo;
-            // add new operand to registers
-            delVariable(varTable->varListReg, tmp);
-            addVariable(varTable->varListReg, regNo, op);
-            return regNo;
+            if (tmp->op->kind != OP_CONSTANT && regNo != registers->lastchangedNo &&
+                !registers->regList[regNo]->isLocked &&
+                (pass == 1 || !registers->regList[regNo]->isDirty))
+            {
+                if (registers->regList[regNo]->isDirty)
+                    writeBackToStack(regNo, varTable, tmp->op);
+                registers->regList[regNo]->isDirty = false;
+                registers->lastchangedNo = regNo;
+                registers->regList[regNo]->isLocked = true;
+                // add new operand to registers
+                delVariable(varTable->varListReg, tmp);
+                addVariable(varTable->varListReg, regNo, op);
+                return regNo;
+            }
+            tmp = tmp->next;
         }
-        tmp = tmp->next;
     }
     // should not reach here
     assert(0);
@@ -239,6 +387,8 @@ pRegister newRegister(const char *regName)
     pRegister p = (pRegister)malloc(sizeof(Register));
     assert(p != nullptr);
     p->isFree = true;
+    p->isLocked = false;
+    p->isDirty = false;
     p->name = regName;
     return p;
 }
@@ -249,156 +399,419 @@ pVariable newVariable(int regNo, pOperand op)
     assert(p != nullptr);
     p->index = regNo;
     p->op = op;
+    p->prev = nullptr;
     p->next = nullptr;
+    p->nextHash = nullptr;
+    return p;
 }
 
 void genAssemblyCode(FILE *fp)
 {
     registers = initRegisters();
     varTable = newVarTable();
-    initCode(fp);
-    pInterCodes tmp = interCodeList->head;
-    while (tmp != nullptr)
+    assemBuffer = newAssemBuffer();
+    pWriter writer = newWriter(fp);
+    if (binaryOutput)
+        objectImage = newObjectImage();
+    initCode();
+    flushAssemBuffer(writer);
+    if (jobNum > 1)
+        genFunctionsParallel(writer);
+    else
     {
-        interToAssem(fp, tmp);
-        debug_devide(fp);
-        tmp = tmp->next;
+        // A label reached by one jump only may disappear with a lowered branch.
+        if (optLevel >= 1)
+            varTable->labelRef = countLabelRef(interCodeList);
+        // The buffer holds one function at a time.
+        pInterCodes func = interCodeList->head;
+        while (func != nullptr)
+        {
+            func = translateFunction(func);
+            flushAssemBuffer(writer);
+        }
+    }
+    if (objectImage != nullptr)
+    {
+        resolveFixups(objectImage);
+        writeElf(writer, objectImage);
+        deleteObjectImage(objectImage);
+        objectImage = nullptr;
+    }
+    deleteWriter(writer);
+    if (printStats)
+    {
+        printPeepholeStats(stderr);
+        printScheduleStats(stderr);
+        fprintf(stderr, "select lowered: %d\n", varTable->selectNum);
+    }
+    deleteAssemBuffer(assemBuffer);
+    assemBuffer = nullptr;
+    deleteRegisters(registers);
+    deleteVarTable(varTable);
+    registers = nullptr;
+    varTable = nullptr;
+}
+
+void genFunctionsParallel(pWriter writer)
+{
+    // Functions share nothing but the inter code, which is only read, and the symbol table.
+    CodegenQueue queue;
+    queue.funcNum = 0;
+    for (pInterCodes p = interCodeList->head; p != nullptr; p = p->next)
+    {
+        if (p->code->kind == IR_FUNCTION)
+            queue.funcNum++;
+    }
+    queue.funcs = (pInterCodes *)malloc((queue.funcNum + 1) * sizeof(pInterCodes));
+    queue.buffers = (pAssemBuffer *)calloc(queue.funcNum + 1, sizeof(pAssemBuffer));
+    assert(queue.funcs != nullptr && queue.buffers != nullptr);
+    int f = 0;
+    for (pInterCodes p = interCodeList->head; p != nullptr; p = p->next)
+    {
+        if (p->code->kind == IR_FUNCTION)
+            queue.funcs[f++] = p;
+    }
+    queue.next = 0;
+    pthread_mutex_init(&queue.lock, nullptr);
+    pthread_cond_init(&queue.done, nullptr);
+    queue.rules = peepholeRules;
+    queue.sched = &schedStats;
+    queue.selectNum = &varTable->selectNum;
+
+    int threadNum = jobNum < queue.funcNum ? jobNum : queue.funcNum;
+    pthread_t *threads = (pthread_t *)malloc((threadNum + 1) * sizeof(pthread_t));
+    assert(threads != nullptr);
+    for (int t = 0; t < threadNum; t++)
+    {
+        int error = pthread_create(&threads[t], nullptr, codegenWorker, &queue);
+        assert(error == 0);
+    }
+    // Print each function as soon as it and the ones before it are done.
+    for (f = 0; f < queue.funcNum; f++)
+    {
+        pthread_mutex_lock(&queue.lock);
+        while (queue.buffers[f] == nullptr)
+            pthread_cond_wait(&queue.done, &queue.lock);
+        pthread_mutex_unlock(&queue.lock);
+        outputAssemBuffer(writer, queue.buffers[f]);
+        deleteAssemBuffer(queue.buffers[f]);
+    }
+    for (int t = 0; t < threadNum; t++)
+        pthread_join(threads[t], nullptr);
+    free(threads);
+    pthread_cond_destroy(&queue.done);
+    pthread_mutex_destroy(&queue.lock);
+    free(queue.buffers);
+    free(queue.funcs);
+}
+
+void *codegenWorker(void *arg)
+{
+    pCodegenQueue queue = (pCodegenQueue)arg;
+    registers = initRegisters();
+    varTable = newVarTable();
+    if (optLevel >= 1)
+        varTable->labelRef = countLabelRef(interCodeList);
+    while (true)
+    {
+        pthread_mutex_lock(&queue->lock);
+        int f = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (f >= queue->funcNum)
+            break;
+        assemBuffer = newAssemBuffer();
+        translateFunction(queue->funcs[f]);
+        optimizeAssemBuffer(assemBuffer);
+        pthread_mutex_lock(&queue->lock);
+        queue->buffers[f] = assemBuffer;
+        pthread_cond_broadcast(&queue->done);
+        pthread_mutex_unlock(&queue->lock);
     }
+
+    pthread_mutex_lock(&queue->lock);
+    for (int k = 0; peepholeRules[k].name != nullptr; k++)
+        queue->rules[k].fired += peepholeRules[k].fired;
+    queue->sched->blocks += schedStats.blocks;
+    queue->sched->moved += schedStats.moved;
+    queue->sched->stallsBefore += schedStats.stallsBefore;
+    queue->sched->stallsAfter += schedStats.stallsAfter;
+    *queue->selectNum += varTable->selectNum;
+    pthread_mutex_unlock(&queue->lock);
+    assemBuffer = nullptr;
     deleteRegisters(registers);
     deleteVarTable(varTable);
     registers = nullptr;
     varTable = nullptr;
+    return nullptr;
+}
+
+pInterCodes translateFunction(pInterCodes func)
+{
+    // Translate the function starting at func into assemBuffer, returns the next function.
+    assert(func->code->kind == IR_FUNCTION);
+    pInterCodes p = func;
+    do
+    {
+        // Some codes are translated together, continue after the last of them.
+        p = interToAssem(p)->next;
+    } while (p != nullptr && p->code->kind != IR_FUNCTION);
+    return p;
+}
+
+void optimizeAssemBuffer(pAssemBuffer buffer)
+{
+    if (optLevel >= 1)
+    {
+        runPeephole(buffer);
+        scheduleBuffer(buffer);
+    }
+}
+
+void flushAssemBuffer(pWriter writer)
+{
+    optimizeAssemBuffer(assemBuffer);
+    outputAssemBuffer(writer, assemBuffer);
+    clearAssemBuffer(assemBuffer);
+}
+
+void outputAssemBuffer(pWriter writer, pAssemBuffer buffer)
+{
+    if (objectImage != nullptr)
+        encodeAssemBuffer(objectImage, buffer);
+    else
+        printAssemBuffer(writer, buffer);
+}
+
+void initCode()
+{
+    emitCode(".data\n");
+    emitCode("_prompt: .asciiz \"Enter an integer:\"\n");
+    emitCode("_ret: .asciiz \"\\n\"\n");
+    if (bufferOutput)
+    {
+        emitCode("_obuf: .space %d\n", OUT_BUF_SIZE);
+        emitCode("_opos: .word 0\n");
+    }
+    emitCode(".globl main\n");
+    emitCode(".text\n");
+    // read and write are inlined, see IR_READ and IR_WRITE.
+    if (!bufferOutput)
+        return;
+
+    // _bwrite appends $a0 and a newline to _obuf, and flushes it when it is nearly full.
+    // Only $a0, $v0 and $v1 change, so callers save nothing.
+    emitCode("_bwrite:\n");
+    emitCode("  addi $sp, $sp, -12\n");
+    emitCode("  sw $t0, 0($sp)\n");
+    emitCode("  sw $t1, 4($sp)\n");
+    emitCode("  sw $t2, 8($sp)\n");
+    emitCode("  la $t0, _opos\n");
+    emitCode("  lw $t1, 0($t0)\n");
+    emitCode("  la $t0, _obuf\n");
+    emitCode("  add $t0, $t0, $t1\n");
+    emitCode("  bgez $a0, _bwrite_len\n");
+    emitCode("  li $v0, 45\n"); // '-'
+    emitCode("  sb $v0, 0($t0)\n");
+    emitCode("  addi $t0, $t0, 1\n");
+    emitCode("  subu $a0, $0, $a0\n"); // -2^31 stays -2^31 without a trap, divu reads it as 2^31
+    emitCode("_bwrite_len:\n");
+    emitCode("  li $v1, 10\n");
+    emitCode("  move $t1, $a0\n");
+    emitCode("_bwrite_count:\n");
+    emitCode("  addi $t0, $t0, 1\n");
+    emitCode("  divu $t1, $v1\n");
+    emitCode("  mflo $t1\n");
+    emitCode("  bnez $t1, _bwrite_count\n");
+    emitCode("  sb $v1, 0($t0)\n"); // '\n' is 10
+    emitCode("  addi $t2, $t0, 1\n");
+    emitCode("_bwrite_digit:\n");
+    emitCode("  addi $t0, $t0, -1\n");
+    emitCode("  divu $a0, $v1\n");
+    emitCode("  mfhi $v0\n");
+    emitCode("  mflo $a0\n");
+    emitCode("  addi $v0, $v0, 48\n");
+    emitCode("  sb $v0, 0($t0)\n");
+    emitCode("  bnez $a0, _bwrite_digit\n");
+    emitCode("  la $t0, _obuf\n");
+    emitCode("  sub $t2, $t2, $t0\n");
+    emitCode("  la $t0, _opos\n");
+    emitCode("  sw $t2, 0($t0)\n");
+    emitCode("  slti $v0, $t2, %d\n", OUT_BUF_SIZE - OUT_LINE_MAX);
+    emitCode("  lw $t0, 0($sp)\n");
+    emitCode("  lw $t1, 4($sp)\n");
+    emitCode("  lw $t2, 8($sp)\n");
+    emitCode("  addi $sp, $sp, 12\n");
+    emitCode("  beqz $v0, _bflush\n");
+    emitCode("  jr $ra\n\n");
+
+    // _bflush prints _obuf with one syscall and empties it, only $a0, $v0 and $v1 change.
+    emitCode("_bflush:\n");
+    emitCode("  la $v1, _opos\n");
+    emitCode("  lw $a0, 0($v1)\n");
+    emitCode("  beqz $a0, _bflush_end\n");
+    emitCode("  sw $0, 0($v1)\n");
+    emitCode("  la $v1, _obuf\n");
+    emitCode("  add $a0, $a0, $v1\n");
+    emitCode("  sb $0, 0($a0)\n");
+    emitCode("  move $a0, $v1\n");
+    emitCode("  li $v0, 4\n");
+    emitCode("  syscall\n");
+    emitCode("_bflush_end:\n");
+    emitCode("  jr $ra\n");
 }
 
-void initCode(FILE *fp)
-{
-    fprintf(fp, ".data\n");
-    fprintf(fp, "_prompt: .asciiz \"Enter an integer:\"\n");
-    fprintf(fp, "_ret: .asciiz \"\\n\"\n");
-    fprintf(fp, ".globl main\n");
-    
-    // read function
-    fprintf(fp, ".text\n");
-    fprintf(fp, "read:\n");
-    fprintf(fp, "  li $v0, 4\n");
-    fprintf(fp, "  la $a0, _prompt\n");
-    fprintf(fp, "  syscall\n");
-    fprintf(fp, "  li $v0, 5\n");
-    fprintf(fp, "  syscall\n");
-    fprintf(fp, "  jr $ra\n\n");
-
-    // write function
-    fprintf(fp, "write:\n");
-    fprintf(fp, "  li $v0, 1\n");
-    fprintf(fp, "  syscall\n");
-    fprintf(fp, "  li $v0, 4\n");
-    fprintf(fp, "  la $a0, _ret\n");
-    fprintf(fp, "  syscall\n");
-    fprintf(fp, "  move $v0, $0\n");
-    fprintf(fp, "  jr $ra\n");
-}
-
-void interToAssem(FILE *fp, pInterCodes interCodes)
+pInterCodes interToAssem(pInterCodes interCodes)
 {
     pInterCode interCode = interCodes->code;
     int kind = interCode->kind;
+    unlockRegisters(registers);
+    int codeNo = varTable->codeNo++;
+    if (kind != IR_FUNCTION && varTable->isFoldedAddr != nullptr && varTable->isFoldedAddr[codeNo])
+    {
+        // Only the next code uses the address, it goes into the offset of its load or store.
+        debug_assem("folded address\n");
+        if (kind == IR_GET_ADDR)
+        {
+            pVariable array = searchVariable(varTable->varListArray, interCode->u.assign.right);
+            assert(array != nullptr);
+            varTable->pendingBase = nullptr;
+            varTable->pendingOffset = array->index;
+            varTable->pendingArray = interCode->u.assign.left;
+        }
+        else
+        {
+            assert(kind == IR_ADD_ADDR);
+            pOperand op1 = interCode->u.binOp.op1, op2 = interCode->u.binOp.op2;
+            if (op1->kind != OP_CONSTANT && op2->kind != OP_CONSTANT)
+            {
+                // The array base from the previous code stays in the offset, the result holds $sp + index.
+                assert(varTable->hasPending && varTable->pendingBase == nullptr);
+                pOperand index = strcmp(op1->u.name, varTable->pendingArray->u.name) ? op1 : op2;
+                pOperand result = interCode->u.binOp.result;
+                int indexRegNo = checkVariable(varTable, registers, index);
+                int resultRegNo = defineVariable(varTable, registers, result);
+                emitCode("  add %s, $sp, %s\n", registers->regList[resultRegNo]->name, registers->regList[indexRegNo]->name);
+                markDirty(resultRegNo, varTable, result);
+                varTable->pendingBase = result;
+                return interCodes;
+            }
+            pOperand base = op1->kind == OP_CONSTANT ? op2 : op1;
+            int offset = op1->kind == OP_CONSTANT ? op1->u.value : op2->u.value;
+            if (varTable->hasPending)
+                varTable->pendingOffset += offset;
+            else
+            {
+                varTable->pendingBase = base;
+                varTable->pendingOffset = offset;
+            }
+        }
+        varTable->hasPending = true;
+        return interCodes;
+    }
     if (kind == IR_LABEL)
     {
         debug_assem("IR_LABEL\n");
-        fprintf(fp, "%s:\n", interCode->u.oneOp.op->u.name);
+        flushRegisters(varTable, registers);
+        forgetRegisters(varTable, registers);
+        emitCode("%s:\n", interCode->u.oneOp.op->u.name);
     }
     else if (kind == IR_FUNCTION)
     {
         debug_assem("IR_FUNCTION\n");
-        fprintf(fp, "\n%s:\n", interCode->u.oneOp.op->u.name);
-        // init $gp
-        fprintf(fp, "  move $gp, $sp\n");
+        emitCode("\n%s:\n", interCode->u.oneOp.op->u.name);
 
         // According to the experiment requirement, there is no global variable.
         // So when calling a function, reset the variable table.
         resetRegisters(registers);
         clearAssemVarList(varTable->varListReg);
         clearAssemVarList(varTable->varListMem);
-        varTable->sp = 0;
-
-        // handle main function specifically.
-        // handle parameters IR_PARAM:
-        pItem item = searchFirstTableItem(table, interCode->u.oneOp.op->u.name + 2);
-        int argc = 0;
-        pInterCodes tmp = interCodes->next;
-        while (tmp != nullptr && tmp->code->kind == IR_PARAM)
+        clearAssemVarList(varTable->varListArray);
+        clearAssemVarList(varTable->varListAlloc);
+        free(varTable->callSaveMask);
+        varTable->callSaveMask = nullptr;
+        varTable->callNo = 0;
+        free(varTable->isFoldedAddr);
+        varTable->isFoldedAddr = nullptr;
+        clearAssemVarList(varTable->varListSlot);
+        free(varTable->slotColor);
+        varTable->slotColor = nullptr;
+        free(varTable->slotLive);
+        varTable->slotLive = nullptr;
+        varTable->slotNum = 0;
+        varTable->codeNo = 1; // positions count from the IR_FUNCTION
+        varTable->funcName = interCode->u.oneOp.op->u.name;
+        varTable->copyNo = 0;
+        varTable->hasPending = false;
+        for (int i = 0; i < REG_NUM; i++)
+            varTable->isHoisted[i] = false;
+        if (optLevel >= 1)
         {
-            pOperand op = tmp->code->u.oneOp.op;
-            // All arguments are stored in the stack
-            assert(op->kind != OP_CONSTANT);
-            addVariable(varTable->varListMem, argc * 4 + 8, op);
-            argc++;
-            tmp = tmp->next;
+            // Allocated registers are never handed out by allocReg.
+            allocateRegisters(interCodes, varTable);
+            for (int i = 0; i < ALLOC_REG_NUM; i++)
+                registers->regList[ALLOC_REGS[i]]->isFree = false;
         }
+        layoutFrame(interCodes, varTable);
 
-        pInterCodes icptr = interCodes->next;
-        while(icptr != nullptr){
-            int kind = icptr->code->kind;
-            pOperand op = nullptr; 
-            if(kind == IR_FUNCTION) break;
-            switch(kind){
-            case IR_READ:
-                op = icptr->code->u.oneOp.op;
-                break;
-            case IR_ASSIGN: // assign
-            case IR_CALL:
-            case IR_GET_ADDR:
-            case IR_READ_ADDR:
-                op = icptr->code->u.assign.left;
-                break;
-            case IR_ADD: // binOp
-            case IR_ADD_ADDR:
-            case IR_SUB:
-            case IR_MUL:
-            case IR_DIV:
-                op = icptr->code->u.binOp.result;
-                break;
-            case IR_DEC: // dec, for function
-                op = icptr->code->u.dec.op;
-                break;
-            default: // Should not reach here.
-                op = nullptr;
-                break;
-            }
-            if(op != nullptr){
-                if(icptr->code->kind == IR_DEC){
-                    varTable->sp -= icptr->code->u.dec.size + 4;
-                    fprintf(fp, "  addi $sp, $sp, -%d\n", icptr->code->u.dec.size);
-                    fprintf(fp, "  sw $sp, -4($sp)\n");
-                    fprintf(fp, "  addi $sp, $sp, -4\n");
-                    addVariable(varTable->varListMem, varTable->sp, op);
-                    fprintf(fp, "    #allocate %d($gp) for array %s with base at %d($gp)\n", varTable->sp, op->u.name, varTable->sp + 4);
-                }
-                else{
-                    // allocate stack space for the variable
-                    fprintf(fp, "  addi $sp, $sp, -4\n");
-                    varTable->sp -= 4;
-                    addVariable(varTable->varListMem, varTable->sp, op);
-                    fprintf(fp, "    #allocate %d($gp) for %s\n",varTable->sp, op->u.name);
-                }
-            }
-            icptr = icptr->next;
+        // One $sp adjustment for the whole frame, $sp does not move until the function returns.
+        if (varTable->frameSize > 0)
+            emitCode("  addi $sp, $sp, -%d\n", varTable->frameSize);
+        if (!varTable->isLeaf)
+            emitCode("  sw $ra, %d($sp)\n", varTable->raSlot);
+        for (int i = S0; i <= S7; i++)
+        {
+            if (varTable->saveSlot[i] >= 0)
+                emitCode("  sw %s, %d($sp)\n", registers->regList[i]->name, varTable->saveSlot[i]);
         }
 
-        
+        // Move parameters to their registers, or to their stack slots if they came in $a0 - $a3.
+        pInterCodes tmp = interCodes->next;
+        for (int i = 0; tmp != nullptr && tmp->code->kind == IR_PARAM; i++, tmp = tmp->next)
+        {
+            pVariable allocated = searchVariable(varTable->varListAlloc, tmp->code->u.oneOp.op);
+            int offset = searchVariable(varTable->varListMem, tmp->code->u.oneOp.op)->index;
+            if (allocated != nullptr && i < ARG_REG_NUM)
+                emitCode("  move %s, %s\n", registers->regList[allocated->index]->name, registers->regList[A0 + i]->name);
+            else if (allocated != nullptr)
+                emitCode("  lw %s, %d($sp)\n", registers->regList[allocated->index]->name, offset);
+            else if (i < ARG_REG_NUM)
+                emitCode("  sw %s, %d($sp)\n", registers->regList[A0 + i]->name, offset);
+        }
+        // The entry comes before every loop of the function.
+        for (int i = 0; i < REG_NUM; i++)
+        {
+            if (varTable->isHoisted[i])
+                emitCode("  li %s, %d\n", registers->regList[i]->name, varTable->hoistedValue[i]);
+        }
     }
     else if (kind == IR_GOTO)
     {
         debug_assem("IR_GOTO\n");
-        fprintf(fp, "  j %s\n", interCode->u.oneOp.op->u.name);
+        flushRegisters(varTable, registers);
+        emitCode("  j %s\n", interCode->u.oneOp.op->u.name);
+        forgetRegisters(varTable, registers);
     }
     else if (kind == IR_RETURN)
     {
         debug_assem("IR_RETURN\n");
         pOperand op = interCode->u.oneOp.op;
-        int regNo = checkVariable(fp, varTable, registers, op);
-        fprintf(fp, "  move $v0, %s\n", registers->regList[regNo]->name);
-        fprintf(fp, "  jr $ra\n");
+        // Buffered output is printed before main returns.
+        if (bufferOutput && varTable->isMain)
+            emitCode("  jal _bflush\n");
+        int regNo = checkVariable(varTable, registers, op);
+        emitCode("  move $v0, %s\n", registers->regList[regNo]->name);
+        for (int i = S0; i <= S7; i++)
+        {
+            if (varTable->saveSlot[i] >= 0)
+                emitCode("  lw %s, %d($sp)\n", registers->regList[i]->name, varTable->saveSlot[i]);
+        }
+        if (!varTable->isLeaf)
+            emitCode("  lw $ra, %d($sp)\n", varTable->raSlot);
+        if (varTable->frameSize > 0)
+            emitCode("  addi $sp, $sp, %d\n", varTable->frameSize);
+        emitCode("  jr $ra\n");
+        // Locals die with the frame, nothing to write back.
+        forgetRegisters(varTable, registers);
     }
     else if (kind == IR_ARG)
     {
@@ -409,83 +822,104 @@ void interToAssem(FILE *fp, pInterCodes interCodes)
     else if (kind == IR_READ)
     {
         debug_assem("IR_READ\n");
-        fprintf(fp, "  addi $sp, $sp, -4\n");
-        fprintf(fp, "  sw $ra, 0($sp)\n");
-        fprintf(fp, "  jal read\n");
-        fprintf(fp, "  lw $ra, 0($sp)\n");
-        fprintf(fp, "  addi $sp, $sp, 4\n");
-        int regNo = checkVariable(fp, varTable, registers, interCode->u.oneOp.op);
-        fprintf(fp, "  move %s, $v0\n", registers->regList[regNo]->name);
-        writeBackToStack(fp, regNo, varTable, interCode->u.oneOp.op);
+        // Print the prompt and read an integer, the output written so far goes first.
+        if (bufferOutput)
+            emitCode("  jal _bflush\n");
+        emitCode("  li $v0, 4\n");
+        emitCode("  la $a0, _prompt\n");
+        emitCode("  syscall\n");
+        emitCode("  li $v0, 5\n");
+        emitCode("  syscall\n");
+        int regNo = defineVariable(varTable, registers, interCode->u.oneOp.op);
+        emitCode("  move %s, $v0\n", registers->regList[regNo]->name);
+        markDirty(regNo, varTable, interCode->u.oneOp.op);
     }
     else if (kind == IR_WRITE)
     {
         debug_assem("IR_WRITE\n");
-        int regNo = checkVariable(fp, varTable, registers, interCode->u.oneOp.op);
-        // caller save $a0 first
-        fprintf(fp, "  addi $sp, $sp, -8\n");
-        fprintf(fp, "  sw $a0, 0($sp)\n");
-        fprintf(fp, "  sw $ra, 4($sp)\n");
-        fprintf(fp, "  move $a0, %s\n", registers->regList[regNo]->name);
-        fprintf(fp, "  jal write\n");
-        fprintf(fp, "  lw $a0, 0($sp)\n");
-        fprintf(fp, "  lw $ra, 4($sp)\n");
-        fprintf(fp, "  addi $sp, $sp, 8\n");
+        // Parameters leave $a0 - $a3 in the prologue, so $a0 is free here.
+        pOperand op = interCode->u.oneOp.op;
+        if (op->kind == OP_CONSTANT)
+            emitCode("  li $a0, %d\n", op->u.value);
+        else
+            emitCode("  move $a0, %s\n", registers->regList[checkVariable(varTable, registers, op)]->name);
+        if (bufferOutput)
+            emitCode("  jal _bwrite\n");
+        else
+        {
+            // The integer, then a newline.
+            emitCode("  li $v0, 1\n");
+            emitCode("  syscall\n");
+            emitCode("  li $v0, 4\n");
+            emitCode("  la $a0, _ret\n");
+            emitCode("  syscall\n");
+        }
     }
     else if (kind == IR_ASSIGN)
     {
         debug_assem("IR_ASSIGN\n");
         pOperand left = interCode->u.assign.left, right = interCode->u.assign.right;
         assert(left->kind == OP_VARIABLE);
-        int leftRegNo = checkVariable(fp, varTable, registers, left);
+        // The operands are read before the result is defined, the result may be one of them and is
+        // only cached in its register once that register holds its value.
+        int leftRegNo;
         if (right->kind == OP_CONSTANT)
         {
-            fprintf(fp, "  li %s, %d\n", registers->regList[leftRegNo]->name, interCode->u.assign.right->u.value);
+            leftRegNo = defineVariable(varTable, registers, left);
+            emitCode("  li %s, %d\n", registers->regList[leftRegNo]->name, interCode->u.assign.right->u.value);
         }
         else if (right->kind == OP_VARIABLE)
         {
-            int rightRegNo = checkVariable(fp, varTable, registers, right);
-            fprintf(fp, "  move %s, %s\n", registers->regList[leftRegNo]->name, registers->regList[rightRegNo]->name);
+            int rightRegNo = checkVariable(varTable, registers, right);
+            leftRegNo = defineVariable(varTable, registers, left);
+            // Coalesced copies share the register.
+            if (rightRegNo != leftRegNo)
+                emitCode("  move %s, %s\n", registers->regList[leftRegNo]->name, registers->regList[rightRegNo]->name);
         }
         else
         {
             assert(0);
         }
-        writeBackToStack(fp, leftRegNo, varTable, left);
+        markDirty(leftRegNo, varTable, left);
     }
     else if (kind == IR_GET_ADDR)
     {
         debug_assem("IR_GET_ADDR\n");
         pOperand left = interCode->u.assign.left, right = interCode->u.assign.right;
-        int leftRegNo = checkVariable(fp, varTable, registers, left);
-        pVariable memTmp = varTable->varListMem->head;
-        while(memTmp != nullptr){
-            assert(memTmp->op->kind == OP_VARIABLE);
-            if(!strcmp(memTmp->op->u.name, right->u.name)){
-                break;
-            }
-            memTmp = memTmp->next;
+        int leftRegNo = defineVariable(varTable, registers, left);
+        pVariable array = searchVariable(varTable->varListArray, right);
+        if (array != nullptr)
+        {
+            // A local array or structure lies in the frame.
+            emitCode("  addi %s, $sp, %d\n", registers->regList[leftRegNo]->name, array->index);
+        }
+        else
+        {
+            // A parameter holds the address.
+            pVariable memTmp = searchVariable(varTable->varListMem, right);
+            assert(memTmp != nullptr);
+            emitCode("  lw %s, %d($sp)\n", registers->regList[leftRegNo]->name, memTmp->index);
         }
-        assert(memTmp != nullptr);
-        fprintf(fp, "  lw %s, %d($gp)\n", registers->regList[leftRegNo]->name, memTmp->index);
-        writeBackToStack(fp, leftRegNo, varTable, left);
+        markDirty(leftRegNo, varTable, left);
     }
     else if (kind == IR_READ_ADDR)
     {
         debug_assem("IR_READ_ADDR\n");
         pOperand left = interCode->u.assign.left, right = interCode->u.assign.right;
-        int leftRegNo = checkVariable(fp, varTable, registers, left);
-        int rightRegNo = checkVariable(fp, varTable, registers, right);
-        fprintf(fp, "  lw %s, 0(%s)\n", registers->regList[leftRegNo]->name, registers->regList[rightRegNo]->name);
-        writeBackToStack(fp, leftRegNo, varTable, left);
+        int offset = 0;
+        int rightRegNo = getAddrReg(right, &offset);
+        int leftRegNo = defineVariable(varTable, registers, left);
+        emitCode("  %s %s, %d(%s)\n", getLoadInstr(right), registers->regList[leftRegNo]->name, offset, registers->regList[rightRegNo]->name);
+        markDirty(leftRegNo, varTable, left);
     }
     else if (kind == IR_WRITE_ADDR)
     {
         debug_assem("IR_WRITE_ADDR\n");
         pOperand left = interCode->u.assign.left, right = interCode->u.assign.right;
-        int leftRegNo = checkVariable(fp, varTable, registers, left);
-        int rightRegNo = checkVariable(fp, varTable, registers, right);
-        fprintf(fp, "  sw %s, 0(%s)\n", registers->regList[rightRegNo]->name, registers->regList[leftRegNo]->name);
+        int offset = 0;
+        int leftRegNo = getAddrReg(left, &offset);
+        int rightRegNo = checkVariable(varTable, registers, right);
+        emitCode("  %s %s, %d(%s)\n", getStoreInstr(left), registers->regList[rightRegNo]->name, offset, registers->regList[leftRegNo]->name);
     }
     else if (kind == IR_CALL)
     {
@@ -494,83 +928,102 @@ void interToAssem(FILE *fp, pInterCodes interCodes)
         assert(left->kind == OP_VARIABLE);
         pItem calledFunc = searchFirstTableItem(table, right->u.name + 2);
         assert(calledFunc != nullptr);
-        int leftRegNo = checkVariable(fp, varTable, registers, left);
+        // The callee may only see the stack slots.
+        flushRegisters(varTable, registers);
         // Preparations before a function call
-        pusha(fp, varTable); // store T0 - T9
-        debug_call("pusha\n");
+        // Only allocated $t registers live across the call are saved, the callee saves $s registers.
+        unsigned saveMask = varTable->callSaveMask != nullptr ? varTable->callSaveMask[varTable->callNo++] : 0;
+        saveRegisters(varTable, saveMask);
+        debug_call("saveRegisters\n");
 
-        // handle arguments: IR_ARG
+        // handle arguments: IR_ARG, the outgoing area is at the bottom of the frame.
         pInterCodes arg = interCodes->prev;
         int argc = 0, tot_argc = calledFunc->field->type->u.func.argc;
-        fprintf(fp, "  addi $sp, $sp, -%d\n", tot_argc * 4);
-        varTable->sp -= tot_argc * 4;
         while (arg != nullptr && argc < tot_argc)
         {
-            int argRegNo = checkVariable(fp, varTable, registers, arg->code->u.oneOp.op);
-            if (arg->code->u.oneOp.op->kind == OP_ADDRESS)
+            pOperand argOp = arg->code->u.oneOp.op;
+            if (argc < ARG_REG_NUM)
+            {
+                // Passed in $a0 - $a3, the callee stores it in its slot only if needed.
+                const char *argRegName = registers->regList[A0 + argc]->name;
+                if (argOp->kind == OP_CONSTANT)
+                    emitCode("  li %s, %d\n", argRegName, argOp->u.value);
+                else
+                {
+                    int argRegNo = checkVariable(varTable, registers, argOp);
+                    if (argOp->kind == OP_ADDRESS)
+                        emitCode("  %s %s, 0(%s)\n", getLoadInstr(argOp), argRegName, registers->regList[argRegNo]->name);
+                    else
+                        emitCode("  move %s, %s\n", argRegName, registers->regList[argRegNo]->name);
+                    registers->regList[argRegNo]->isLocked = false;
+                }
+                argc++;
+                arg = arg->prev;
+                continue;
+            }
+            int argRegNo = checkVariable(varTable, registers, argOp);
+            int valRegNo = argRegNo;
+            if (argOp->kind == OP_ADDRESS)
             {
-                fprintf(fp, "  lw %s, 0(%s)\n", registers->regList[argRegNo]->name, registers->regList[argRegNo]->name);
+                // The register keeps the address for later codes, load into another one.
+                valRegNo = allocReg(registers, varTable, &copyTmp);
+                emitCode("  %s %s, 0(%s)\n", getLoadInstr(argOp), registers->regList[valRegNo]->name, registers->regList[argRegNo]->name);
             }
 
             // All arguments are stored in stack.
-            fprintf(fp, "  sw %s, %d($sp)\n", registers->regList[argRegNo]->name, 4 * argc);
+            emitCode("  sw %s, %d($sp)\n", registers->regList[valRegNo]->name, 4 * argc);
+            registers->regList[argRegNo]->isLocked = false;
+            registers->regList[valRegNo]->isLocked = false;
             argc++;
 
             arg = arg->prev;
         }
         debug_call("handle arguments\n");
-        // store fp and ra
-        fprintf(fp, "  addi $sp, $sp, -8\n");
-        varTable->sp -= 8;
-        fprintf(fp, "  sw $ra, 0($sp)\n");
-        fprintf(fp, "  sw $gp, 4($sp)\n");
-
-        // function call
-        fprintf(fp, "  jal %s\n", interCode->u.assign.right->u.name);
-
-        // recover the top of stack
-        fprintf(fp, "  move $sp, $gp\n");
-        // recover $ra and $gp
-        fprintf(fp, "  lw $ra, 0($sp)\n");
-        fprintf(fp, "  lw $gp, 4($sp)\n");
-        fprintf(fp, "  addi $sp, $sp, %d\n", 8 + tot_argc * 4);
-        varTable->sp += 8 + tot_argc * 4;
-        // recover T0-T9
-        popa(fp, varTable);
-        debug_call("popa\n");
+
+        // function call, $ra is saved in the prologue
+        emitCode("  jal %s\n", interCode->u.assign.right->u.name);
+
+        // recover the saved registers
+        restoreRegisters(varTable, saveMask);
+        debug_call("restoreRegisters\n");
 
         // assign return value
-        fprintf(fp, "  move %s, $v0\n", registers->regList[leftRegNo]->name);
+        forgetRegisters(varTable, registers);
+        int leftRegNo = defineVariable(varTable, registers, left);
+        emitCode("  move %s, $v0\n", registers->regList[leftRegNo]->name);
 
-        writeBackToStack(fp, leftRegNo, varTable, left);
+        markDirty(leftRegNo, varTable, left);
     }
     else if (kind == IR_ADD || kind == IR_ADD_ADDR)
     {
         debug_assem("IR_ADD\n");
         pOperand result = interCode->u.binOp.result;
         pOperand op1 = interCode->u.binOp.op1, op2 = interCode->u.binOp.op2;
-        int resultRegNo = checkVariable(fp, varTable, registers, result);
+        int resultRegNo; // defined after the operands are read, see IR_ASSIGN
         // constant and constant
         if (op1->kind == OP_CONSTANT && op2->kind == OP_CONSTANT)
         {
-            fprintf(fp, "  li %s, %d\n",
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitCode("  li %s, %d\n",
                     registers->regList[resultRegNo]->name,
                     op1->u.value + op2->u.value);
         }
         // variable and constant
-        else if (op1->kind != OP_CONSTANT && op2->kind == OP_CONSTANT)
+        else if (op1->kind != OP_CONSTANT && op2->kind == OP_CONSTANT && isImmediate(op2->u.value))
         {
-            int op1RegNo = checkVariable(fp, varTable, registers, op1);
-            fprintf(fp, "  addi %s, %s, %d\n",
+            int op1RegNo = checkVariable(varTable, registers, op1);
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitCode("  addi %s, %s, %d\n",
                     registers->regList[resultRegNo]->name,
                     registers->regList[op1RegNo]->name,
                     op2->u.value);
         }
         // constant and variable
-        else if (op1->kind == OP_CONSTANT && op2->kind != OP_CONSTANT)
+        else if (op1->kind == OP_CONSTANT && op2->kind != OP_CONSTANT && isImmediate(op1->u.value))
         {
-            int op2RegNo = checkVariable(fp, varTable, registers, op2);
-            fprintf(fp, "  addi %s, %s, %d\n",
+            int op2RegNo = checkVariable(varTable, registers, op2);
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitCode("  addi %s, %s, %d\n",
                     registers->regList[resultRegNo]->name,
                     registers->regList[op2RegNo]->name,
                     op1->u.value);
@@ -578,33 +1031,36 @@ void interToAssem(FILE *fp, pInterCodes interCodes)
         // variable and variable
         else
         {
-            int op1RegNo = checkVariable(fp, varTable, registers, op1);
-            int op2RegNo = checkVariable(fp, varTable, registers, op2);
-            fprintf(fp, "  add %s, %s, %s\n",
+            int op1RegNo = checkVariable(varTable, registers, op1);
+            int op2RegNo = checkVariable(varTable, registers, op2);
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitCode("  add %s, %s, %s\n",
                     registers->regList[resultRegNo]->name,
                     registers->regList[op1RegNo]->name,
                     registers->regList[op2RegNo]->name);
         }
-        writeBackToStack(fp, resultRegNo, varTable, result);
+        markDirty(resultRegNo, varTable, result);
     }
     else if (kind == IR_SUB)
     {
         debug_assem("IR_SUB\n");
         pOperand result = interCode->u.binOp.result;
         pOperand op1 = interCode->u.binOp.op1, op2 = interCode->u.binOp.op2;
-        int resultRegNo = checkVariable(fp, varTable, registers, result);
+        int resultRegNo; // defined after the operands are read, see IR_ASSIGN
         // constant and constant
         if (op1->kind == OP_CONSTANT && op2->kind == OP_CONSTANT)
         {
-            fprintf(fp, "  li %s, %d\n",
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitCode("  li %s, %d\n",
                     registers->regList[resultRegNo]->name,
                     op1->u.value - op2->u.value);
         }
-        // variable and constant
-        else if (op1->kind != OP_CONSTANT && op2->kind == OP_CONSTANT)
+        // variable and constant, -IMM_MIN is no immediate
+        else if (op1->kind != OP_CONSTANT && op2->kind == OP_CONSTANT && isImmediate(op2->u.value) && op2->u.value != IMM_MIN)
         {
-            int op1RegNo = checkVariable(fp, varTable, registers, op1);
-            fprintf(fp, "  addi %s, %s, %d\n",
+            int op1RegNo = checkVariable(varTable, registers, op1);
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitCode("  addi %s, %s, %d\n",
                     registers->regList[resultRegNo]->name,
                     registers->regList[op1RegNo]->name,
                     -op2->u.value);
@@ -612,108 +1068,861 @@ void interToAssem(FILE *fp, pInterCodes interCodes)
         // variable and variable && constant and variable
         else
         {
-            int op1RegNo = checkVariable(fp, varTable, registers, op1);
-            int op2RegNo = checkVariable(fp, varTable, registers, op2);
-            fprintf(fp, "  sub %s, %s, %s\n",
+            int op1RegNo = checkVariable(varTable, registers, op1);
+            int op2RegNo = checkVariable(varTable, registers, op2);
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitCode("  sub %s, %s, %s\n",
                     registers->regList[resultRegNo]->name,
                     registers->regList[op1RegNo]->name,
                     registers->regList[op2RegNo]->name);
         }
-        writeBackToStack(fp, resultRegNo, varTable, result);
+        markDirty(resultRegNo, varTable, result);
     }
     else if (kind == IR_MUL)
     {
         debug_assem("IR_MUL\n");
         pOperand result = interCode->u.binOp.result;
         pOperand op1 = interCode->u.binOp.op1, op2 = interCode->u.binOp.op2;
-        int resultRegNo = checkVariable(fp, varTable, registers, result);
-        int op1RegNo = checkVariable(fp, varTable, registers, op1);
-        int op2RegNo = checkVariable(fp, varTable, registers, op2);
-        fprintf(fp, "  mul %s, %s, %s\n", registers->regList[resultRegNo]->name,
-                registers->regList[op1RegNo]->name,
-                registers->regList[op2RegNo]->name);
-        writeBackToStack(fp, resultRegNo, varTable, result);
+        int resultRegNo; // defined after the operands are read, see IR_ASSIGN
+        // Keep the constant on the right.
+        if (op1->kind == OP_CONSTANT)
+        {
+            pOperand tmp = op1;
+            op1 = op2;
+            op2 = tmp;
+        }
+        if (op1->kind == OP_CONSTANT)
+        {
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitCode("  li %s, %d\n", registers->regList[resultRegNo]->name,
+                    (int)((unsigned)op1->u.value * (unsigned)op2->u.value));
+        }
+        else if (optLevel >= 1 && op2->kind == OP_CONSTANT && getMulConstCost(op2->u.value) <= MUL_SHIFT_MAX)
+        {
+            int op1RegNo = checkVariable(varTable, registers, op1);
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitMulConst(resultRegNo, op1RegNo, op2->u.value);
+        }
+        else
+        {
+            int op1RegNo = checkVariable(varTable, registers, op1);
+            int op2RegNo = checkVariable(varTable, registers, op2);
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitCode("  mul %s, %s, %s\n", registers->regList[resultRegNo]->name,
+                    registers->regList[op1RegNo]->name,
+                    registers->regList[op2RegNo]->name);
+        }
+        markDirty(resultRegNo, varTable, result);
     }
     else if (kind == IR_DIV)
     {
         debug_assem("IR_DIV\n");
         pOperand result = interCode->u.binOp.result;
         pOperand op1 = interCode->u.binOp.op1, op2 = interCode->u.binOp.op2;
-        int resultRegNo = checkVariable(fp, varTable, registers, result);
-        int op1RegNo = checkVariable(fp, varTable, registers, op1);
-        int op2RegNo = checkVariable(fp, varTable, registers, op2);
-        fprintf(fp, "  div %s, %s\n", registers->regList[op1RegNo]->name,
-                registers->regList[op2RegNo]->name);
-        fprintf(fp, "  mflo %s\n", registers->regList[resultRegNo]->name);
-        writeBackToStack(fp, resultRegNo, varTable, result);
+        int resultRegNo; // defined after the operands are read, see IR_ASSIGN
+        if (op1->kind == OP_CONSTANT && op2->kind == OP_CONSTANT && op2->u.value != 0 &&
+            !(op1->u.value == INT_MIN && op2->u.value == -1))
+        {
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitCode("  li %s, %d\n", registers->regList[resultRegNo]->name, op1->u.value / op2->u.value);
+        }
+        else if (optLevel >= 1 && op1->kind != OP_CONSTANT && op2->kind == OP_CONSTANT && op2->u.value != 0)
+        {
+            // Shifts for powers of 2, a multiplication by the magic number for the others.
+            int op1RegNo = checkVariable(varTable, registers, op1);
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitDivConst(resultRegNo, op1RegNo, op2->u.value);
+        }
+        else
+        {
+            int op1RegNo = checkVariable(varTable, registers, op1);
+            int op2RegNo = checkVariable(varTable, registers, op2);
+            resultRegNo = defineVariable(varTable, registers, result);
+            emitCode("  div %s, %s\n", registers->regList[op1RegNo]->name,
+                    registers->regList[op2RegNo]->name);
+            emitCode("  mflo %s\n", registers->regList[resultRegNo]->name);
+        }
+        markDirty(resultRegNo, varTable, result);
     }
     else if (kind == IR_DEC)
     {
     } // handle in IR_FUNCTION
+    else if (kind == IR_COPY)
+    {
+        debug_assem("IR_COPY\n");
+        pOperand dst = interCode->u.copy.dst, src = interCode->u.copy.src;
+        int size = interCode->u.copy.size;
+        assert(size > 0 && size % 4 == 0);
+        int dstRegNo = checkVariable(varTable, registers, dst);
+        int srcRegNo = checkVariable(varTable, registers, src);
+        int tmpRegNo = allocReg(registers, varTable, &copyTmp);
+        if (size / 4 <= COPY_UNROLL_WORDS)
+        {
+            // Small struct: one lw/sw pair per word.
+            for (int offset = 0; offset < size; offset += 4)
+            {
+                emitCode("  lw %s, %d(%s)\n", registers->regList[tmpRegNo]->name, offset, registers->regList[srcRegNo]->name);
+                emitCode("  sw %s, %d(%s)\n", registers->regList[tmpRegNo]->name, offset, registers->regList[dstRegNo]->name);
+            }
+        }
+        else
+        {
+            // Large struct: walk both addresses until the source end.
+            // dst and src are released once copied, so the loop needs at most 4 scratch registers.
+            int srcPtrRegNo = allocReg(registers, varTable, &copyTmp);
+            emitCode("  move %s, %s\n", registers->regList[srcPtrRegNo]->name, registers->regList[srcRegNo]->name);
+            registers->regList[srcRegNo]->isLocked = false;
+            int dstPtrRegNo = allocReg(registers, varTable, &copyTmp);
+            emitCode("  move %s, %s\n", registers->regList[dstPtrRegNo]->name, registers->regList[dstRegNo]->name);
+            registers->regList[dstRegNo]->isLocked = false;
+            int endRegNo = allocReg(registers, varTable, &copyTmp);
+            const char *srcPtr = registers->regList[srcPtrRegNo]->name;
+            const char *dstPtr = registers->regList[dstPtrRegNo]->name;
+            const char *tmpReg = registers->regList[tmpRegNo]->name;
+            emitCode("  addi %s, %s, %d\n", registers->regList[endRegNo]->name, srcPtr, size);
+            // Labels are numbered in each function, so that functions can be translated in any order. The
+            // dot keeps them apart from function labels, which no C-- identifier can make contain one.
+            emitCode("%s.copy%d:\n", varTable->funcName, varTable->copyNo);
+            emitCode("  lw %s, 0(%s)\n", tmpReg, srcPtr);
+            emitCode("  sw %s, 0(%s)\n", tmpReg, dstPtr);
+            emitCode("  addi %s, %s, 4\n", srcPtr, srcPtr);
+            emitCode("  addi %s, %s, 4\n", dstPtr, dstPtr);
+            emitCode("  bne %s, %s, %s.copy%d\n", srcPtr, registers->regList[endRegNo]->name, varTable->funcName,
+                    varTable->copyNo);
+            varTable->copyNo++;
+        }
+    }
     else if (kind == IR_IF_GOTO)
     { // GOTO statement
         debug_assem("IR_IF_GOTO\n");
-        char *relopName = interCode->u.ifGoto.relop->u.name;
+        // A small diamond or triangle becomes a conditional move.
+        pInterCodes last = optLevel >= 1 ? lowerSelect(interCodes) : nullptr;
+        if (last != nullptr)
+            return last;
+        const char *relopName = interCode->u.ifGoto.relop->u.name;
+        const char *label = interCode->u.ifGoto.z->u.name;
         pOperand x = interCode->u.ifGoto.x, y = interCode->u.ifGoto.y;
-        int xRegNo = checkVariable(fp, varTable, registers, x);
-        int yRegNo = checkVariable(fp, varTable, registers, y);
-        if (!strcmp(relopName, "=="))
-            fprintf(fp, "  beq %s, %s, %s\n", registers->regList[xRegNo]->name,
-                    registers->regList[yRegNo]->name,
-                    interCode->u.ifGoto.z->u.name);
-        else if (!strcmp(relopName, "!="))
-            fprintf(fp, "  bne %s, %s, %s\n", registers->regList[xRegNo]->name,
-                    registers->regList[yRegNo]->name,
-                    interCode->u.ifGoto.z->u.name);
-        else if (!strcmp(relopName, ">"))
-            fprintf(fp, "  bgt %s, %s, %s\n", registers->regList[xRegNo]->name,
-                    registers->regList[yRegNo]->name,
-                    interCode->u.ifGoto.z->u.name);
-        else if (!strcmp(relopName, "<"))
-            fprintf(fp, "  blt %s, %s, %s\n", registers->regList[xRegNo]->name,
-                    registers->regList[yRegNo]->name,
-                    interCode->u.ifGoto.z->u.name);
-        else if (!strcmp(relopName, ">="))
-            fprintf(fp, "  bge %s, %s, %s\n", registers->regList[xRegNo]->name,
-                    registers->regList[yRegNo]->name,
-                    interCode->u.ifGoto.z->u.name);
-        else if (!strcmp(relopName, "<="))
-            fprintf(fp, "  ble %s, %s, %s\n", registers->regList[xRegNo]->name,
-                    registers->regList[yRegNo]->name,
-                    interCode->u.ifGoto.z->u.name);
-    }
-}
-
-void pusha(FILE *fp, pVarTable varTable)
-{
-    fprintf(fp, "  addi $sp, $sp, -72\n");
-    varTable->sp -= 72;
-    for (int i = T0; i <= T9; i++)
+        if (optLevel >= 1 && x->kind == OP_CONSTANT && y->kind != OP_CONSTANT)
+        {
+            // Keep the constant on the right, c < y is y > c.
+            pOperand tmp = x;
+            x = y;
+            y = tmp;
+            relopName = getSwappedRelop(relopName);
+        }
+        boolean isOrder = strcmp(relopName, "==") && strcmp(relopName, "!=");
+        boolean isUpper = !strcmp(relopName, ">") || !strcmp(relopName, "<=");
+        if (optLevel >= 1 && x->kind != OP_CONSTANT && y->kind == OP_CONSTANT && y->u.value == 0)
+        {
+            // Branches compare with $0 themselves.
+            int xRegNo = checkVariable(varTable, registers, x);
+            flushRegisters(varTable, registers);
+            emitCode("  %s %s, %s\n", getZeroBranch(relopName), registers->regList[xRegNo]->name, label);
+        }
+        else if (optLevel >= 1 && isOrder && x->kind != OP_CONSTANT && y->kind == OP_CONSTANT &&
+                 isImmediate(y->u.value) && isImmediate(y->u.value + isUpper))
+        {
+            // x < c and x >= c test slti x, c; x <= c and x > c test slti x, c + 1.
+            int xRegNo = checkVariable(varTable, registers, x);
+            int tmpRegNo = allocReg(registers, varTable, &copyTmp);
+            const char *tmp = registers->regList[tmpRegNo]->name;
+            emitCode("  slti %s, %s, %d\n", tmp, registers->regList[xRegNo]->name, y->u.value + isUpper);
+            flushRegisters(varTable, registers);
+            boolean isLess = !strcmp(relopName, "<") || !strcmp(relopName, "<=");
+            emitCode("  %s %s, $0, %s\n", isLess ? "bne" : "beq", tmp, label);
+        }
+        else
+        {
+            int xRegNo = checkVariable(varTable, registers, x);
+            int yRegNo = checkVariable(varTable, registers, y);
+            // Both successors see the stack slots, the fall through keeps the registers too.
+            flushRegisters(varTable, registers);
+            const char *branch = "ble";
+            if (!strcmp(relopName, "=="))
+                branch = "beq";
+            else if (!strcmp(relopName, "!="))
+                branch = "bne";
+            else if (!strcmp(relopName, ">"))
+                branch = "bgt";
+            else if (!strcmp(relopName, "<"))
+                branch = "blt";
+            else if (!strcmp(relopName, ">="))
+                branch = "bge";
+            emitCode("  %s %s, %s, %s\n", branch, registers->regList[xRegNo]->name,
+                    registers->regList[yRegNo]->name, label);
+        }
+    }
+    return interCodes;
+}
+
+pInterCodes lowerSelect(pInterCodes ifGoto)
+{
+    // if (c) goto L1; A; goto L2; L1: B; L2:  is x = c ? B : A, and if (c) goto L1; A; L1:  is x = c ? x : A,
+    // when A and B are single copies, additions or subtractions to x. Both values are computed, and
+    // movn or movz picks one. Returns the last code translated, nullptr if ifGoto starts neither.
+    pInterCode code = ifGoto->code;
+    pOperand label = code->u.ifGoto.z;
+    if (varTable->labelRef[getLabelNo(label)] != 1)
+        return nullptr;
+    pInterCodes falseArm = ifGoto->next, trueArm = nullptr, last = nullptr;
+    pOperand x = falseArm != nullptr ? getSelectDest(falseArm->code) : nullptr;
+    if (x == nullptr || falseArm->next == nullptr)
+        return nullptr;
+    pInterCodes next = falseArm->next;
+    if (isLabelOf(next, label))
+        last = next;
+    else if (next->code->kind == IR_GOTO && isLabelOf(next->next, label))
+    {
+        pOperand endLabel = next->code->u.oneOp.op;
+        trueArm = next->next->next;
+        pOperand trueDest = trueArm != nullptr ? getSelectDest(trueArm->code) : nullptr;
+        if (trueDest == nullptr || strcmp(trueDest->u.name, x->u.name) || !isLabelOf(trueArm->next, endLabel))
+            return nullptr;
+        // Other jumps to L2 still need it.
+        last = varTable->labelRef[getLabelNo(endLabel)] == 1 ? trueArm->next : trueArm;
+    }
+    else
+        return nullptr;
+    // Everything the select reads or computes stays locked until x is written, keep the branch
+    // when allocReg could run out of registers.
+    if (getSelectRegNum(code, falseArm->code, trueArm != nullptr ? trueArm->code : nullptr, x) > getScratchRegNum())
+        return nullptr;
+
+    // Every operand is read before x is written.
+    boolean isNonZero;
+    int condRegNo = emitCondition(code->u.ifGoto.relop->u.name, code->u.ifGoto.x, code->u.ifGoto.y, &isNonZero);
+    int falseRegNo = getSelectValue(falseArm->code);
+    int trueRegNo = trueArm != nullptr ? getSelectValue(trueArm->code) : checkVariable(varTable, registers, x);
+    int xRegNo = defineVariable(varTable, registers, x);
+    if (trueRegNo == xRegNo)
+    {
+        // x already holds the true value, pick the false one on the opposite condition.
+        int tmp = trueRegNo;
+        trueRegNo = falseRegNo;
+        falseRegNo = tmp;
+        isNonZero = !isNonZero;
+    }
+    if (falseRegNo != xRegNo)
+    {
+        if (condRegNo == xRegNo)
+        {
+            // The condition is x itself, keep it before the move.
+            int tmpRegNo = allocReg(registers, varTable, &copyTmp);
+            emitCode("  move %s, %s\n", registers->regList[tmpRegNo]->name, registers->regList[condRegNo]->name);
+            condRegNo = tmpRegNo;
+        }
+        emitCode("  move %s, %s\n", registers->regList[xRegNo]->name, registers->regList[falseRegNo]->name);
+    }
+    if (trueRegNo != xRegNo)
+        emitCode("  %s %s, %s, %s\n", isNonZero ? "movn" : "movz", registers->regList[xRegNo]->name,
+                registers->regList[trueRegNo]->name, registers->regList[condRegNo]->name);
+    markDirty(xRegNo, varTable, x);
+    varTable->selectNum++;
+
+    // The skipped codes keep their positions.
+    for (pInterCodes p = ifGoto; p != last; p = p->next)
+        varTable->codeNo++;
+    return last;
+}
+
+pOperand getSelectDest(pInterCode code)
+{
+    // The variable code assigns, nullptr if code may not be executed on both paths of a select.
+    if (code->kind == IR_ASSIGN)
     {
-        fprintf(fp, "  sw %s, %d($sp)\n", registers->regList[i]->name, (i - T0) * 4);
+        pOperand right = code->u.assign.right;
+        if (right->kind == OP_VARIABLE || right->kind == OP_CONSTANT)
+            return code->u.assign.left;
+        return nullptr;
     }
+    if (code->kind != IR_ADD && code->kind != IR_SUB)
+        return nullptr;
+    pOperand op1 = code->u.binOp.op1, op2 = code->u.binOp.op2;
+    if ((op1->kind != OP_VARIABLE && op1->kind != OP_CONSTANT) ||
+        (op2->kind != OP_VARIABLE && op2->kind != OP_CONSTANT) ||
+        code->u.binOp.result->kind != OP_VARIABLE)
+        return nullptr;
+    return code->u.binOp.result;
+}
+
+int getOperandRegNum(pOperand op)
+{
+    // 1 if reading op takes a register from allocReg.
+    if (op->kind == OP_CONSTANT)
+        return op->u.value != 0 && getHoistedReg(varTable, op->u.value) < 0;
+    return searchVariable(varTable->varListAlloc, op) == nullptr;
+}
+
+int getSelectArmRegNum(pInterCode code)
+{
+    // The registers getSelectValue locks for code at most.
+    if (code->kind == IR_ASSIGN)
+        return getOperandRegNum(code->u.assign.right);
+    pOperand op1 = code->u.binOp.op1, op2 = code->u.binOp.op2;
+    if (op1->kind == OP_CONSTANT && op2->kind == OP_CONSTANT)
+        return 1;
+    int num = 1 + getOperandRegNum(op1) + getOperandRegNum(op2);
+    if (op2->kind == OP_CONSTANT && isImmediate(op2->u.value) && op2->u.value != IMM_MIN)
+        num -= getOperandRegNum(op2);
+    else if (code->kind == IR_ADD && op1->kind == OP_CONSTANT && isImmediate(op1->u.value))
+        num -= getOperandRegNum(op1);
+    return num;
+}
+
+int getSelectRegNum(pInterCode ifGoto, pInterCode falseArm, pInterCode trueArm, pOperand x)
+{
+    // The registers lowerSelect locks at most: the condition and its operands, both values, x, and a
+    // copy of the condition when it is x itself.
+    pOperand condX = ifGoto->u.ifGoto.x, condY = ifGoto->u.ifGoto.y;
+    int num = 1 + getOperandRegNum(condX) + getOperandRegNum(condY);
+    num += getSelectArmRegNum(falseArm);
+    num += trueArm != nullptr ? getSelectArmRegNum(trueArm) : getOperandRegNum(x);
+    num += 2 * getOperandRegNum(x);
+    return num;
 }
 
-void popa(FILE *fp, pVarTable varTable)
+int getScratchRegNum()
 {
+    // The registers allocReg can still hand out: free ones and those only caching a value. The one
+    // changed last is not taken first, it is left out.
+    int num = 0;
     for (int i = T0; i <= T9; i++)
     {
-        fprintf(fp, "  lw %s, %d($sp)\n", registers->regList[i]->name, (i - T0) * 4);
+        boolean isCached = false;
+        for (pVariable p = varTable->varListReg->head; p != nullptr && !isCached; p = p->next)
+            isCached = p->index == i;
+        if (registers->regList[i]->isFree ||
+            (isCached && !registers->regList[i]->isLocked && i != registers->lastchangedNo))
+            num++;
     }
-    fprintf(fp, "  addi $sp, $sp, 72\n");
-    varTable->sp += 72;
+    return num;
 }
 
-void writeBackToStack(FILE* fp, int regNo, pVarTable varTable, pOperand op){
-    assert(op != nullptr);
-    //if(op->loopCond == 0) return;
-    pVariable memTmp = varTable->varListMem->head;
-    while(memTmp != nullptr){
-        if(!strcmp(memTmp->op->u.name, op->u.name)){
+int getSelectValue(pInterCode code)
+{
+    // The register holding the value code assigns, computed into a scratch register if needed.
+    // Both arms of a select run, so the arm not taken must not trap on overflow: addiu, addu and subu.
+    if (code->kind == IR_ASSIGN)
+        return checkVariable(varTable, registers, code->u.assign.right);
+    boolean isAdd = code->kind == IR_ADD;
+    pOperand op1 = code->u.binOp.op1, op2 = code->u.binOp.op2;
+    int tmpRegNo = allocReg(registers, varTable, &copyTmp);
+    const char *tmp = registers->regList[tmpRegNo]->name;
+    if (op1->kind == OP_CONSTANT && op2->kind == OP_CONSTANT)
+        emitCode("  li %s, %d\n", tmp, isAdd ? op1->u.value + op2->u.value : op1->u.value - op2->u.value);
+    else if (op2->kind == OP_CONSTANT && isImmediate(op2->u.value) && (isAdd || op2->u.value != IMM_MIN))
+        emitCode("  addiu %s, %s, %d\n", tmp, registers->regList[checkVariable(varTable, registers, op1)]->name,
+                isAdd ? op2->u.value : -op2->u.value);
+    else if (isAdd && op1->kind == OP_CONSTANT && isImmediate(op1->u.value))
+        emitCode("  addiu %s, %s, %d\n", tmp, registers->regList[checkVariable(varTable, registers, op2)]->name,
+                op1->u.value);
+    else
+    {
+        int op1RegNo = checkVariable(varTable, registers, op1);
+        int op2RegNo = checkVariable(varTable, registers, op2);
+        emitCode("  %s %s, %s, %s\n", isAdd ? "addu" : "subu", tmp, registers->regList[op1RegNo]->name,
+                registers->regList[op2RegNo]->name);
+    }
+    return tmpRegNo;
+}
+
+int emitCondition(const char *relop, pOperand x, pOperand y, boolean *isNonZero)
+{
+    // A register that is nonzero exactly when (x relop y) == *isNonZero.
+    if (x->kind == OP_CONSTANT && y->kind != OP_CONSTANT)
+    {
+        pOperand tmp = x;
+        x = y;
+        y = tmp;
+        relop = getSwappedRelop(relop);
+    }
+    boolean isEqual = !strcmp(relop, "==") || !strcmp(relop, "!=");
+    boolean isUpper = !strcmp(relop, ">") || !strcmp(relop, "<=");
+    *isNonZero = !strcmp(relop, "!=") || !strcmp(relop, "<") || !strcmp(relop, ">");
+    int xRegNo = checkVariable(varTable, registers, x);
+    if (isEqual && y->kind == OP_CONSTANT && y->u.value == 0)
+        return xRegNo;
+    int condRegNo = allocReg(registers, varTable, &copyTmp);
+    const char *cond = registers->regList[condRegNo]->name;
+    const char *xReg = registers->regList[xRegNo]->name;
+    if (isEqual && y->kind == OP_CONSTANT && isImmediate(y->u.value) && y->u.value != IMM_MIN)
+        emitCode("  addi %s, %s, %d\n", cond, xReg, -y->u.value);
+    else if (!isEqual && y->kind == OP_CONSTANT && isImmediate(y->u.value) && isImmediate(y->u.value + isUpper))
+    {
+        // x <= c is x < c + 1, and x > c is its opposite.
+        emitCode("  slti %s, %s, %d\n", cond, xReg, y->u.value + isUpper);
+        if (isUpper)
+            *isNonZero = !*isNonZero;
+    }
+    else
+    {
+        const char *yReg = registers->regList[checkVariable(varTable, registers, y)]->name;
+        if (isEqual)
+            emitCode("  xor %s, %s, %s\n", cond, xReg, yReg);
+        else if (isUpper)
+            emitCode("  slt %s, %s, %s\n", cond, yReg, xReg);
+        else
+            emitCode("  slt %s, %s, %s\n", cond, xReg, yReg);
+    }
+    return condRegNo;
+}
+
+boolean isLabelOf(pInterCodes p, pOperand label)
+{
+    return p != nullptr && p->code->kind == IR_LABEL && !strcmp(p->code->u.oneOp.op->u.name, label->u.name);
+}
+
+int getAddrReg(pOperand addr, int *offset)
+{
+    // The base register and offset of the address a load or store goes through.
+    if (!varTable->hasPending)
+    {
+        *offset = 0;
+        return checkVariable(varTable, registers, addr);
+    }
+    varTable->hasPending = false;
+    int baseRegNo = varTable->pendingBase == nullptr ? SP : checkVariable(varTable, registers, varTable->pendingBase);
+    *offset = varTable->pendingOffset;
+    if (isImmediate(*offset))
+        return baseRegNo;
+    int regNo = allocReg(registers, varTable, &copyTmp);
+    emitCode("  addi %s, %s, %d\n", registers->regList[regNo]->name, registers->regList[baseRegNo]->name, *offset);
+    registers->regList[baseRegNo]->isLocked = false;
+    *offset = 0;
+    return regNo;
+}
+
+const char *getLoadInstr(pOperand addr)
+{
+    // addr holds an address, pick the load for the width of the value it points to.
+    if (addr->width == 1)
+        return addr->isUnsigned ? "lbu" : "lb";
+    assert(addr->width == 4);
+    return "lw";
+}
+
+const char *getStoreInstr(pOperand addr)
+{
+    if (addr->width == 1)
+        return "sb";
+    assert(addr->width == 4);
+    return "sw";
+}
+
+boolean isImmediate(int value)
+{
+    return value >= IMM_MIN && value <= IMM_MAX;
+}
+
+int getLog2(unsigned value)
+{
+    // The exponent if value is a power of 2, -1 otherwise.
+    if (value == 0 || (value & (value - 1)) != 0)
+        return -1;
+    return __builtin_ctz(value);
+}
+
+int getMulConstCost(int value)
+{
+    // Instructions emitMulConst needs for value = +-(2^m +- 1) * 2^b, MUL_SHIFT_MAX + 1 if it is no such value.
+    if (value == 0 || value == 1 || value == -1)
+        return 1;
+    unsigned absValue = value < 0 ? -(unsigned)value : (unsigned)value;
+    int b = __builtin_ctz(absValue);
+    unsigned odd = absValue >> b;
+    int cost = (b > 0) + (value < 0);
+    if (odd != 1)
+    {
+        if (getLog2(odd - 1) < 0 && getLog2(odd + 1) < 0)
+            return MUL_SHIFT_MAX + 1;
+        cost += 2;
+    }
+    return cost;
+}
+
+void emitMulConst(int resultRegNo, int srcRegNo, int value)
+{
+    // result = src * value with shifts and adds, getMulConstCost(value) must not exceed MUL_SHIFT_MAX.
+    // mul does not trap and the shifted src may wrap even if the product fits, so addu and subu.
+    const char *result = registers->regList[resultRegNo]->name;
+    const char *src = registers->regList[srcRegNo]->name;
+    if (value == 0)
+    {
+        emitCode("  li %s, 0\n", result);
+        return;
+    }
+    if (value == 1)
+    {
+        if (resultRegNo != srcRegNo)
+            emitCode("  move %s, %s\n", result, src);
+        return;
+    }
+    unsigned absValue = value < 0 ? -(unsigned)value : (unsigned)value;
+    int b = __builtin_ctz(absValue);
+    unsigned odd = absValue >> b;
+    if (odd != 1)
+    {
+        // src * (2^m + 1) = (src << m) + src, src * (2^m - 1) = (src << m) - src
+        int tmpRegNo = allocReg(registers, varTable, &copyTmp);
+        const char *tmp = registers->regList[tmpRegNo]->name;
+        int m = getLog2(odd - 1);
+        boolean isAdd = m >= 0;
+        if (!isAdd)
+            m = getLog2(odd + 1);
+        assert(m > 0);
+        emitCode("  sll %s, %s, %d\n", tmp, src, m);
+        emitCode("  %s %s, %s, %s\n", isAdd ? "addu" : "subu", result, tmp, src);
+        registers->regList[tmpRegNo]->isLocked = false;
+        src = result;
+    }
+    if (b > 0)
+    {
+        emitCode("  sll %s, %s, %d\n", result, src, b);
+        src = result;
+    }
+    if (value < 0)
+        emitCode("  subu %s, $0, %s\n", result, src);
+}
+
+void emitDivConst(int resultRegNo, int srcRegNo, int value)
+{
+    // result = src / value rounded toward zero, value is not 0. Like div it never traps, -INT_MIN is
+    // INT_MIN through subu.
+    const char *result = registers->regList[resultRegNo]->name;
+    const char *src = registers->regList[srcRegNo]->name;
+    assert(value != 0);
+    if (value == 1 || value == -1)
+    {
+        if (value == -1)
+            emitCode("  subu %s, $0, %s\n", result, src);
+        else if (resultRegNo != srcRegNo)
+            emitCode("  move %s, %s\n", result, src);
+        return;
+    }
+    int tmpRegNo = allocReg(registers, varTable, &copyTmp);
+    const char *tmp = registers->regList[tmpRegNo]->name;
+    unsigned absValue = value < 0 ? -(unsigned)value : (unsigned)value;
+    int k = getLog2(absValue);
+    if (k > 0)
+    {
+        // Add 2^k - 1 to a negative src so that the shift rounds toward zero.
+        if (k == 1)
+            emitCode("  srl %s, %s, 31\n", tmp, src);
+        else
+        {
+            emitCode("  sra %s, %s, 31\n", tmp, src);
+            emitCode("  srl %s, %s, %d\n", tmp, tmp, 32 - k);
+        }
+        emitCode("  addu %s, %s, %s\n", tmp, tmp, src);
+        emitCode("  sra %s, %s, %d\n", result, tmp, k);
+        if (value < 0)
+            emitCode("  subu %s, $0, %s\n", result, result);
+    }
+    else
+    {
+        // Multiply by the magic number and keep the high word, then add 1 if the quotient is negative.
+        int magic, shift;
+        computeMagic(value, &magic, &shift);
+        int magicRegNo = getHoistedReg(varTable, magic);
+        if (magicRegNo < 0)
+        {
+            emitCode("  li %s, %d\n", tmp, magic);
+            magicRegNo = tmpRegNo;
+        }
+        emitCode("  mult %s, %s\n", src, registers->regList[magicRegNo]->name);
+        emitCode("  mfhi %s\n", tmp);
+        if (value > 0 && magic < 0)
+            emitCode("  addu %s, %s, %s\n", tmp, tmp, src);
+        else if (value < 0 && magic > 0)
+            emitCode("  subu %s, %s, %s\n", tmp, tmp, src);
+        if (shift > 0)
+            emitCode("  sra %s, %s, %d\n", tmp, tmp, shift);
+        emitCode("  srl %s, %s, 31\n", result, value > 0 ? src : tmp);
+        emitCode("  addu %s, %s, %s\n", result, tmp, result);
+    }
+    registers->regList[tmpRegNo]->isLocked = false;
+}
+
+void computeMagic(int divisor, int *magic, int *shift)
+{
+    // Magic number of signed division by divisor, |divisor| >= 2 and not a power of 2.
+    // See Hacker's Delight, 10-1.
+    const unsigned two31 = 0x80000000u;
+    unsigned ad = divisor < 0 ? -(unsigned)divisor : (unsigned)divisor;
+    unsigned t = two31 + ((unsigned)divisor >> 31);
+    unsigned anc = t - 1 - t % ad;
+    unsigned q1 = two31 / anc, r1 = two31 - q1 * anc;
+    unsigned q2 = two31 / ad, r2 = two31 - q2 * ad;
+    unsigned delta;
+    int p = 31;
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *magic = (int)(divisor < 0 ? -(q2 + 1) : q2 + 1);
+    *shift = p - 32;
+}
+
+const char *getSwappedRelop(const char *relop)
+{
+    // x relop y is y getSwappedRelop(relop) x.
+    if (!strcmp(relop, ">"))
+        return "<";
+    if (!strcmp(relop, "<"))
+        return ">";
+    if (!strcmp(relop, ">="))
+        return "<=";
+    if (!strcmp(relop, "<="))
+        return ">=";
+    return relop;
+}
+
+const char *getZeroBranch(const char *relop)
+{
+    // The branch comparing a register with 0.
+    if (!strcmp(relop, "=="))
+        return "beqz";
+    if (!strcmp(relop, "!="))
+        return "bnez";
+    if (!strcmp(relop, ">"))
+        return "bgtz";
+    if (!strcmp(relop, "<"))
+        return "bltz";
+    if (!strcmp(relop, ">="))
+        return "bgez";
+    assert(!strcmp(relop, "<="));
+    return "blez";
+}
+
+void saveRegisters(pVarTable varTable, unsigned mask)
+{
+    // Store the registers in mask to the save area of the frame, one word each in register order.
+    int offset = varTable->saveBase;
+    for (int i = 0; i < REG_NUM; i++)
+    {
+        if (mask & (1u << i))
+        {
+            emitCode("  sw %s, %d($sp)\n", registers->regList[i]->name, offset);
+            offset += 4;
+        }
+    }
+}
+
+void restoreRegisters(pVarTable varTable, unsigned mask)
+{
+    int offset = varTable->saveBase;
+    for (int i = 0; i < REG_NUM; i++)
+    {
+        if (mask & (1u << i))
+        {
+            emitCode("  lw %s, %d($sp)\n", registers->regList[i]->name, offset);
+            offset += 4;
+        }
+    }
+}
+
+void layoutFrame(pInterCodes func, pVarTable varTable)
+{
+    /*
+    The frame, from $sp up:
+      outgoing arguments, one word for each parameter of the largest callee
+      caller-saved registers of the call that saves the most
+      local variables, spilled ones share slots at -O1, then local arrays and structures
+      callee-saved $s registers, then $ra unless the function is a leaf
+    Parameters stay in the frame of the caller, at frameSize + 4i($sp).
+    */
+    int outSize = 0, saveSize = 0, callNo = 0;
+    varTable->isLeaf = true;
+    pInterCodes p = func->next;
+    for (; p != nullptr && p->code->kind != IR_FUNCTION; p = p->next)
+    {
+        int kind = p->code->kind;
+        if (kind == IR_CALL)
+        {
+            pItem calledFunc = searchFirstTableItem(table, p->code->u.assign.right->u.name + 2);
+            assert(calledFunc != nullptr);
+            int size = 4 * calledFunc->field->type->u.func.argc;
+            outSize = size > outSize ? size : outSize;
+            if (varTable->callSaveMask != nullptr)
+            {
+                size = 4 * __builtin_popcount(varTable->callSaveMask[callNo++]);
+                saveSize = size > saveSize ? size : saveSize;
+            }
+        }
+        // read and write are inlined, unless they go through the output buffer.
+        if (kind == IR_CALL || (bufferOutput && (kind == IR_READ || kind == IR_WRITE)))
+            varTable->isLeaf = false;
+    }
+    varTable->isMain = !strcmp(func->code->u.oneOp.op->u.name, "main");
+    if (bufferOutput && varTable->isMain)
+        varTable->isLeaf = false;
+    varTable->saveBase = outSize;
+    int offset = outSize + saveSize;
+    int slotBase = offset;
+    offset += 4 * varTable->slotNum;
+
+    // Parameters first, so that they get no local slot, their offsets are known at the end.
+    p = func->next;
+    for (; p != nullptr && p->code->kind == IR_PARAM; p = p->next)
+    {
+        assert(p->code->u.oneOp.op->kind != OP_CONSTANT);
+        addVariable(varTable->varListMem, 0, p->code->u.oneOp.op);
+    }
+    for (; p != nullptr && p->code->kind != IR_FUNCTION; p = p->next)
+    {
+        pInterCode code = p->code;
+        pOperand op = nullptr;
+        switch (code->kind)
+        {
+        case IR_READ:
+            op = code->u.oneOp.op;
+            break;
+        case IR_ASSIGN: // assign
+        case IR_CALL:
+        case IR_GET_ADDR:
+        case IR_READ_ADDR:
+            op = code->u.assign.left;
+            break;
+        case IR_ADD: // binOp
+        case IR_ADD_ADDR:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+            op = code->u.binOp.result;
             break;
+        case IR_DEC: // dec, for function
+            op = code->u.dec.op;
+            break;
+        default:
+            op = nullptr;
+            break;
+        }
+        if (op == nullptr)
+            continue;
+        if (code->kind == IR_DEC)
+        {
+            addVariable(varTable->varListArray, offset, op);
+            if (emitComments)
+                emitCode("    #allocate %d($sp) for array %s\n", offset, op->u.name);
+            // Byte arrays are padded so that slots stay word aligned.
+            offset += (code->u.dec.size + 3) / 4 * 4;
+        }
+        else if (searchVariable(varTable->varListMem, op) == nullptr &&
+                 searchVariable(varTable->varListAlloc, op) == nullptr &&
+                 searchVariable(varTable->varListSlot, op) != nullptr)
+        {
+            int slotOffset = slotBase + 4 * varTable->slotColor[searchVariable(varTable->varListSlot, op)->index];
+            addVariable(varTable->varListMem, slotOffset, op);
+            if (emitComments)
+                emitCode("    #allocate %d($sp) for %s\n", slotOffset, op->u.name);
+        }
+        else if (searchVariable(varTable->varListMem, op) == nullptr &&
+                 searchVariable(varTable->varListAlloc, op) == nullptr)
+        {
+            // allocate stack space for the variable, once per name since temporaries are reused
+            addVariable(varTable->varListMem, offset, op);
+            if (emitComments)
+                emitCode("    #allocate %d($sp) for %s\n", offset, op->u.name);
+            offset += 4;
+        }
+    }
+
+    // Save the $s registers the function uses, main has no caller to save them for.
+    for (int i = 0; i < REG_NUM; i++)
+        varTable->saveSlot[i] = -1;
+    if (!varTable->isMain)
+    {
+        for (pVariable var = varTable->varListAlloc->head; var != nullptr; var = var->next)
+        {
+            if (var->index < S0 || var->index > S7 || varTable->saveSlot[var->index] >= 0)
+                continue;
+            varTable->saveSlot[var->index] = offset;
+            offset += 4;
+        }
+        for (int i = S0; i <= S7; i++)
+        {
+            if (!varTable->isHoisted[i] || varTable->saveSlot[i] >= 0)
+                continue;
+            varTable->saveSlot[i] = offset;
+            offset += 4;
+        }
+    }
+    if (!varTable->isLeaf)
+    {
+        varTable->raSlot = offset;
+        offset += 4;
+    }
+    varTable->frameSize = offset;
+
+    p = func->next;
+    for (int i = 0; p != nullptr && p->code->kind == IR_PARAM; i++, p = p->next)
+        searchVariable(varTable->varListMem, p->code->u.oneOp.op)->index = offset + 4 * i;
+}
+
+void markDirty(int regNo, pVarTable varTable, pOperand op)
+{
+    // op is defined in regNo, its stack slot is written when the register is flushed or evicted.
+    assert(op != nullptr);
+    if (searchVariable(varTable->varListAlloc, op) != nullptr)
+        return;
+    registers->regList[regNo]->isDirty = true;
+}
+
+void flushRegisters(pVarTable varTable, pRegisters registers)
+{
+    // Write dirty variables back at the end of a block, the registers keep their values.
+    for (pVariable tmp = varTable->varListReg->head; tmp != nullptr; tmp = tmp->next)
+    {
+        if (tmp->op->kind != OP_CONSTANT && registers->regList[tmp->index]->isDirty)
+        {
+            writeBackToStack(tmp->index, varTable, tmp->op);
+            registers->regList[tmp->index]->isDirty = false;
         }
-        memTmp = memTmp->next;
     }
+}
+
+void forgetRegisters(pVarTable varTable, pRegisters registers)
+{
+    // Another block may jump here, nothing is known about the registers.
+    for (pVariable tmp = varTable->varListReg->head; tmp != nullptr; tmp = tmp->next)
+    {
+        registers->regList[tmp->index]->isFree = true;
+        registers->regList[tmp->index]->isDirty = false;
+    }
+    clearAssemVarList(varTable->varListReg);
+}
+
+boolean isSlotLive(pVarTable varTable, pOperand op)
+{
+    // Whether op is live before the code being translated, true if nothing is known.
+    pVariable slot = searchVariable(varTable->varListSlot, op);
+    if (slot == nullptr || varTable->slotLive == nullptr)
+        return true;
+    unsigned *live = &varTable->slotLive[(varTable->codeNo - 1) * varTable->slotWords];
+    return (live[slot->index / 32] & (1u << (slot->index % 32))) != 0;
+}
+
+void writeBackToStack(int regNo, pVarTable varTable, pOperand op){
+    assert(op != nullptr);
+    // The slot of a dead variable may belong to another one now.
+    if (!isSlotLive(varTable, op))
+        return;
+    pVariable memTmp = searchVariable(varTable->varListMem, op);
     assert(memTmp != nullptr);
-    fprintf(fp, "  sw %s, %d($gp)\n", registers->regList[regNo]->name, memTmp->index);
+    emitCode("  sw %s, %d($sp)\n", registers->regList[regNo]->name, memTmp->index);
 }
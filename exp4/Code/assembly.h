@@ -2,26 +2,55 @@
 #ifndef ASSEMBLY_H
 #define ASSEMBLY_H
 
+#include <pthread.h>
 #include "inter.h"
 #include "node.h"
+#include "peephole.h"
+#include "schedule.h"
+#include "encode.h"
 
 #define REG_NUM 32
 
+// The first arguments are passed in $a0 - $a3, the others in the stack.
+#define ARG_REG_NUM 4
+
+// Struct copies up to this many words are unrolled, larger ones use a loop.
+#define COPY_UNROLL_WORDS 8
+
+// Range of the 16-bit signed immediate of addi and slti.
+#define IMM_MIN (-32768)
+#define IMM_MAX 32767
+
+// Multiplications by a constant that need more shifts and adds than this keep mul.
+#define MUL_SHIFT_MAX 3
+
+// -buffer-output: write appends to a buffer of this many bytes, flushed when less than
+// OUT_LINE_MAX bytes are left, before each read and when main returns.
+#define OUT_BUF_SIZE 4096
+#define OUT_LINE_MAX 16
+
+// Buckets of the variable location index, a power of 2.
+#define VAR_HASH_SIZE 0x4000
+
 typedef struct _register* pRegister;
 typedef struct _variable* pVariable;
 typedef struct _registers* pRegisters;
 typedef struct _assemVarList* pAssemVarList;
 typedef struct _varTable* pVarTable;
+typedef struct _codegenQueue* pCodegenQueue;
 
 typedef struct _register{
     boolean isFree;
+    boolean isLocked; // used by the instruction being translated, never evicted
+    boolean isDirty; // holds a newer value than the stack slot of its variable
     const char* name;
 } Register;
 
 typedef struct _variable{
     int index; // regNo or offset from $fp
     pOperand op;
-    pVariable next;
+    pVariable prev, next;
+    pVariable nextHash; // next variable with the same hash code
 } Variable;
 
 typedef struct _registers{
@@ -32,14 +61,55 @@ typedef struct _registers{
 typedef struct _assemVarList {
     pVariable head;
     pVariable cur;
+    pVariable hash[VAR_HASH_SIZE]; // variables indexed by operand name
 } AssemVarList;
 
 typedef struct _varTable{
     pAssemVarList varListReg; // The variable table in registers
-    pAssemVarList varListMem; // The variable table in memory;
-    int sp; // For local variables in the stack
+    pAssemVarList varListMem; // The variable table in memory, index is the offset from $sp
+    pAssemVarList varListArray; // Local arrays and structures, index is the offset of the base from $sp
+    pAssemVarList varListAlloc; // Variables kept in one register through the function, see regalloc.c
+    pAssemVarList varListSlot; // Spilled variables, index is their number in slotColor and slotLive
+    int *slotColor; // stack slot shared by each spilled variable, see colorStackSlots
+    int slotNum; // slots the spilled variables take, 0 at -O0
+    unsigned *slotLive; // spilled variables live before each code, slotWords words per position
+    int slotWords;
+    unsigned *callSaveMask; // registers live across each call of the function, in code order
+    int callNo; // calls translated so far in the function
+    boolean *isFoldedAddr; // address codes folded into the next load or store, by position in the function
+    int codeNo; // position of the code being translated
+    boolean hasPending; // the previous code was folded, its address is pendingBase + pendingOffset
+    pOperand pendingBase; // nullptr for $sp
+    pOperand pendingArray; // the temporary a folded &a was meant for
+    int pendingOffset;
+    int saveSlot[REG_NUM]; // slots of the $s registers saved by the function, -1 if not saved
+    boolean isHoisted[REG_NUM]; // holds hoistedValue[reg] through the function, loaded in the prologue
+    int hoistedValue[REG_NUM];
+    int frameSize; // $sp is moved once by frameSize in the prologue, see layoutFrame
+    int saveBase; // caller-saved registers are stored from saveBase($sp) around a call
+    int raSlot;
+    boolean isLeaf; // no jal in the function, $ra is not saved
+    boolean isMain;
+    const char *funcName;
+    int copyNo; // loops of large struct copies in the function
+    int *labelRef; // jumps to each label of the program, nullptr at -O0
+    int selectNum; // branches turned into movn and movz, see lowerSelect
 } VarTable;
 
+// -j: functions handed out to the threads in order, the output is printed in the same order.
+typedef struct _codegenQueue {
+    pInterCodes *funcs; // first code of each function
+    pAssemBuffer *buffers; // assembly of each function, nullptr until it is translated
+    int funcNum;
+    int next; // the next function to translate
+    pthread_mutex_t lock;
+    pthread_cond_t done; // signaled when a buffer is filled
+    // Counts of the main thread, the threads add theirs before they exit.
+    pPeepholeRule rules;
+    SchedStats *sched;
+    int *selectNum;
+} CodegenQueue;
+
 // Enum defined for registers
 typedef enum _regNo {
     ZERO,    AT,
@@ -54,35 +124,82 @@ typedef enum _regNo {
     GP,    SP,    FP,    RA,
 } RegNo;
 
-pRegisters registers;
-pVarTable varTable;
+// State of the function being translated, each thread translates its own functions.
+extern __thread pRegisters registers;
+extern __thread pVarTable varTable;
 
 pRegisters initRegisters();
 void resetRegisters(pRegisters registers);
 void deleteRegisters(pRegisters registers);
+void unlockRegisters(pRegisters registers);
 
 pVarTable newVarTable();
 pAssemVarList newAssemVarList();
 void printAssemVarList(FILE* fp, pAssemVarList varList);
 void addVariable(pAssemVarList varList, int regNo, pOperand op);
+pVariable searchVariable(pAssemVarList varList, pOperand op);
+pVariable searchConstant(pAssemVarList varList, int value);
+int getHoistedReg(pVarTable varTable, int value);
 void removeVariable(pAssemVarList varList, pVariable var);
 void delVariable(pAssemVarList varList, pVariable var);
 void clearAssemVarList(pAssemVarList AssemVarList);
-int checkVariable(FILE* fp, pVarTable varTable, pRegisters registers, pOperand op);
+int checkVariable(pVarTable varTable, pRegisters registers, pOperand op);
+int defineVariable(pVarTable varTable, pRegisters registers, pOperand op);
 
-int allocReg(pRegisters registers, pVarTable varTable, pOperand op, FILE* fp);
+int allocReg(pRegisters registers, pVarTable varTable, pOperand op);
+void flushRegisters(pVarTable varTable, pRegisters registers);
+void forgetRegisters(pVarTable varTable, pRegisters registers);
 
 pRegister newRegister(const char* regName);
 pVariable newVariable(int regNo, pOperand op);
 
 void genAssemblyCode(FILE* fp);
-void initCode(FILE* fp);
-void interToAssem(FILE* fp, pInterCodes interCodes);
-
-void pusha(FILE* fp, pVarTable varTable);
-void popa(FILE* fp, pVarTable varTable);
-
-void writeBackToStack(FILE* fp, int regNo, pVarTable varTable, pOperand op);
+void genFunctionsParallel(pWriter writer);
+void *codegenWorker(void* arg);
+pInterCodes translateFunction(pInterCodes func);
+void optimizeAssemBuffer(pAssemBuffer buffer);
+void flushAssemBuffer(pWriter writer);
+void outputAssemBuffer(pWriter writer, pAssemBuffer buffer);
+void initCode();
+pInterCodes interToAssem(pInterCodes interCodes);
+
+static inline unsigned int getVarHashCode(pOperand op) {
+    // FNV-1a on the operand name, constants are all kept in bucket 0.
+    if (op->kind == OP_CONSTANT)
+        return 0;
+    unsigned int val = 2166136261u;
+    for (char* name = op->u.name; *name; ++name)
+        val = (val ^ (unsigned char)*name) * 16777619u;
+    return val & (VAR_HASH_SIZE - 1);
+}
+
+int getAddrReg(pOperand addr, int *offset);
+const char *getLoadInstr(pOperand addr);
+const char *getStoreInstr(pOperand addr);
+boolean isImmediate(int value);
+int getLog2(unsigned value);
+int getMulConstCost(int value);
+void emitMulConst(int resultRegNo, int srcRegNo, int value);
+void emitDivConst(int resultRegNo, int srcRegNo, int value);
+void computeMagic(int divisor, int *magic, int *shift);
+const char *getSwappedRelop(const char *relop);
+const char *getZeroBranch(const char *relop);
+pInterCodes lowerSelect(pInterCodes ifGoto);
+pOperand getSelectDest(pInterCode code);
+int getSelectValue(pInterCode code);
+int getOperandRegNum(pOperand op);
+int getSelectArmRegNum(pInterCode code);
+int getSelectRegNum(pInterCode ifGoto, pInterCode falseArm, pInterCode trueArm, pOperand x);
+int getScratchRegNum();
+int emitCondition(const char *relop, pOperand x, pOperand y, boolean *isNonZero);
+boolean isLabelOf(pInterCodes p, pOperand label);
+void saveRegisters(pVarTable varTable, unsigned mask);
+void restoreRegisters(pVarTable varTable, unsigned mask);
+void layoutFrame(pInterCodes func, pVarTable varTable);
+
+void markDirty(int regNo, pVarTable varTable, pOperand op);
+boolean isSlotLive(pVarTable varTable, pOperand op);
+void writeBackToStack(int regNo, pVarTable varTable, pOperand op);
 
 
 #endif
\ No newline at end of file
@@ -1,8 +1,12 @@
 import os
+import re
+import shutil
+import subprocess
 
 parser = "./parser"
 result = "../Result/"
 test = "../Test/"
+spim = "spim"
 
 
 for dirpath, dirnames, filenames in os.walk(test):
@@ -11,4 +15,37 @@ for dirpath, dirnames, filenames in os.walk(test):
             targetname = result + filename.split('.')[0] + '.output'
             target = open(targetname, 'w')
             target.write(os.popen(parser + ' ' + test +filename).read())
-            target.close()
\ No newline at end of file
+            target.close()
+
+
+# Regression inputs give their input and expected output in header comments:
+#   // read: 97 100        the integers read() returns
+#   // expect: 97 101      the integers written
+#   // flags: -buffer-output
+# They are compiled at every -O level and run when spim is installed.
+def header(path, key):
+    for line in open(path):
+        if line.startswith('// ' + key + ':'):
+            return line.split(':', 1)[1].split()
+    return None
+
+
+if shutil.which(spim) is not None:
+    failed = 0
+    for filename in sorted(os.listdir(test)):
+        expect = header(test + filename, 'expect')
+        if expect is None:
+            continue
+        read = header(test + filename, 'read') or []
+        flags = header(test + filename, 'flags') or []
+        for level in ['-O0', '-O1', '-O2']:
+            targetname = result + filename.split('.')[0] + level + '.s'
+            subprocess.run([parser, test + filename, targetname, level] + flags)
+            run = subprocess.run([spim, '-file', targetname], input='\n'.join(read) + '\n',
+                                 capture_output=True, text=True)
+            output = run.stdout.replace('Enter an integer:', ' ').split()
+            output = [word for word in output if re.fullmatch(r'-?[0-9]+', word)]
+            if output != expect:
+                failed += 1
+                print('FAIL', filename, level, ' '.join(output))
+    print('regression inputs:', 'all passed' if failed == 0 else str(failed) + ' failed')
@@ -0,0 +1,711 @@
+#include "encode.h"
+#include "assembly.h"
+
+pObjectImage objectImage = nullptr;
+
+#define REG_AT 1
+#define REG_RA 31
+
+#define R_TYPE(rs, rt, rd, shamt, funct) \
+    (((unsigned int)(rs) << 21) | ((rt) << 16) | ((rd) << 11) | ((shamt) << 6) | (funct))
+#define I_TYPE(opcode, rs, rt, imm) \
+    (((unsigned int)(opcode) << 26) | ((rs) << 21) | ((rt) << 16) | ((imm) & 0xffff))
+#define J_TYPE(opcode, target) (((unsigned int)(opcode) << 26) | ((target) & 0x3ffffff))
+
+typedef struct _encoding {
+    const char *name;
+    enum {
+        ENC_R3, // rd, rs, rt
+        ENC_SHIFT, // rd, rt, shamt
+        ENC_SHIFTV, // rd, rt, rs
+        ENC_MULDIV, // rs, rt
+        ENC_MOVE_FROM, // rd
+        ENC_JR, // rs
+        ENC_JALR, // rs, links $ra
+        ENC_SYSCALL,
+        ENC_IMM, // rt, rs, imm
+        ENC_LUI, // rt, imm
+        ENC_MEM, // rt, offset(rs)
+        ENC_BRANCH2, // rs, rt, label
+        ENC_BRANCH1, // rs, label
+        ENC_JUMP, // label
+        // Pseudo instructions, $at is never allocated so the expansions may use it.
+        ENC_LI, // rt, imm
+        ENC_LA, // rt, label
+        ENC_MOVE, // rd, rs
+        ENC_NOP,
+        ENC_BRANCH0, // label
+        ENC_BRANCHZ, // rs, label
+        ENC_BRANCH_CMP, // rs, rt, label, slt into $at and branch on it
+    } format;
+    int opcode;
+    int funct; // rt of the REGIMM branches, 1 if ENC_BRANCH_CMP compares the other way round
+    int regFunct; // the register form of ENC_IMM, used when the immediate does not fit
+    boolean isUnsigned; // immediate is zero extended
+} Encoding;
+
+// Sorted by name for bsearch.
+static const Encoding encodings[] = {
+    {"add", ENC_R3, 0x00, 0x20, -1, false},
+    {"addi", ENC_IMM, 0x08, 0, 0x20, false},
+    {"addiu", ENC_IMM, 0x09, 0, 0x21, false},
+    {"addu", ENC_R3, 0x00, 0x21, -1, false},
+    {"and", ENC_R3, 0x00, 0x24, -1, false},
+    {"andi", ENC_IMM, 0x0c, 0, 0x24, true},
+    {"b", ENC_BRANCH0, 0x04, 0, -1, false},
+    {"beq", ENC_BRANCH2, 0x04, 0, -1, false},
+    {"beqz", ENC_BRANCHZ, 0x04, 0, -1, false},
+    {"bge", ENC_BRANCH_CMP, 0x04, 0, -1, false},
+    {"bgez", ENC_BRANCH1, 0x01, 1, -1, false},
+    {"bgt", ENC_BRANCH_CMP, 0x05, 1, -1, false},
+    {"bgtz", ENC_BRANCH1, 0x07, 0, -1, false},
+    {"ble", ENC_BRANCH_CMP, 0x04, 1, -1, false},
+    {"blez", ENC_BRANCH1, 0x06, 0, -1, false},
+    {"blt", ENC_BRANCH_CMP, 0x05, 0, -1, false},
+    {"bltz", ENC_BRANCH1, 0x01, 0, -1, false},
+    {"bne", ENC_BRANCH2, 0x05, 0, -1, false},
+    {"bnez", ENC_BRANCHZ, 0x05, 0, -1, false},
+    {"div", ENC_MULDIV, 0x00, 0x1a, -1, false},
+    {"divu", ENC_MULDIV, 0x00, 0x1b, -1, false},
+    {"j", ENC_JUMP, 0x02, 0, -1, false},
+    {"jal", ENC_JUMP, 0x03, 0, -1, false},
+    {"jalr", ENC_JALR, 0x00, 0x09, -1, false},
+    {"jr", ENC_JR, 0x00, 0x08, -1, false},
+    {"la", ENC_LA, 0x00, 0, -1, false},
+    {"lb", ENC_MEM, 0x20, 0, -1, false},
+    {"lbu", ENC_MEM, 0x24, 0, -1, false},
+    {"li", ENC_LI, 0x00, 0, -1, false},
+    {"lui", ENC_LUI, 0x0f, 0, -1, true},
+    {"lw", ENC_MEM, 0x23, 0, -1, false},
+    {"mfhi", ENC_MOVE_FROM, 0x00, 0x10, -1, false},
+    {"mflo", ENC_MOVE_FROM, 0x00, 0x12, -1, false},
+    {"move", ENC_MOVE, 0x00, 0x21, -1, false},
+    {"movn", ENC_R3, 0x00, 0x0b, -1, false},
+    {"movz", ENC_R3, 0x00, 0x0a, -1, false},
+    {"mul", ENC_R3, 0x1c, 0x02, -1, false},
+    {"mult", ENC_MULDIV, 0x00, 0x18, -1, false},
+    {"multu", ENC_MULDIV, 0x00, 0x19, -1, false},
+    {"nop", ENC_NOP, 0x00, 0, -1, false},
+    {"nor", ENC_R3, 0x00, 0x27, -1, false},
+    {"or", ENC_R3, 0x00, 0x25, -1, false},
+    {"ori", ENC_IMM, 0x0d, 0, 0x25, true},
+    {"sb", ENC_MEM, 0x28, 0, -1, false},
+    {"sll", ENC_SHIFT, 0x00, 0, -1, false},
+    {"sllv", ENC_SHIFTV, 0x00, 0x04, -1, false},
+    {"slt", ENC_R3, 0x00, 0x2a, -1, false},
+    {"slti", ENC_IMM, 0x0a, 0, 0x2a, false},
+    {"sltiu", ENC_IMM, 0x0b, 0, 0x2b, false},
+    {"sltu", ENC_R3, 0x00, 0x2b, -1, false},
+    {"sra", ENC_SHIFT, 0x00, 0x03, -1, false},
+    {"srav", ENC_SHIFTV, 0x00, 0x07, -1, false},
+    {"srl", ENC_SHIFT, 0x00, 0x02, -1, false},
+    {"srlv", ENC_SHIFTV, 0x00, 0x06, -1, false},
+    {"sub", ENC_R3, 0x00, 0x22, -1, false},
+    {"subu", ENC_R3, 0x00, 0x23, -1, false},
+    {"sw", ENC_MEM, 0x2b, 0, -1, false},
+    {"syscall", ENC_SYSCALL, 0x00, 0x0c, -1, false},
+    {"xor", ENC_R3, 0x00, 0x26, -1, false},
+    {"xori", ENC_IMM, 0x0e, 0, 0x26, true},
+};
+
+static int compareEncoding(const void *key, const void *enc)
+{
+    return strcmp((const char *)key, ((const Encoding *)enc)->name);
+}
+
+static inline unsigned int getSymbolHashCode(const char *name)
+{
+    unsigned int val = 2166136261u;
+    for (; *name; ++name)
+        val = (val ^ (unsigned char)*name) * 16777619u;
+    return val % SYMBOL_HASH_SIZE;
+}
+
+static inline unsigned int getWord(const unsigned char *bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+}
+
+static inline void putWord(unsigned char *bytes, unsigned int word)
+{
+    bytes[0] = word & 0xff;
+    bytes[1] = (word >> 8) & 0xff;
+    bytes[2] = (word >> 16) & 0xff;
+    bytes[3] = word >> 24;
+}
+
+static inline void putHalf(unsigned char *bytes, unsigned int half)
+{
+    bytes[0] = half & 0xff;
+    bytes[1] = (half >> 8) & 0xff;
+}
+
+static inline boolean isImmFit(int value, boolean isUnsigned)
+{
+    return isUnsigned ? value >= 0 && value <= 0xffff : value >= -0x8000 && value < 0x8000;
+}
+
+static void initSection(pSection section, int kind, unsigned int base)
+{
+    section->kind = kind;
+    section->bytes = nullptr;
+    section->size = 0;
+    section->capacity = 0;
+    section->base = base;
+}
+
+pObjectImage newObjectImage()
+{
+    pObjectImage p = (pObjectImage)malloc(sizeof(ObjectImage));
+    assert(p != nullptr);
+    initSection(&p->text, SECTION_TEXT, TEXT_BASE);
+    initSection(&p->data, SECTION_DATA, DATA_BASE);
+    p->current = &p->text;
+    for (int i = 0; i < SYMBOL_HASH_SIZE; i++)
+        p->buckets[i] = nullptr;
+    p->symbols = nullptr;
+    p->lastSymbol = nullptr;
+    p->symbolNum = 0;
+    p->fixups = nullptr;
+    return p;
+}
+
+void deleteObjectImage(pObjectImage image)
+{
+    assert(image != nullptr);
+    free(image->text.bytes);
+    free(image->data.bytes);
+    pSymbol symbol = image->symbols;
+    while (symbol != nullptr)
+    {
+        pSymbol next = symbol->next;
+        free(symbol->name);
+        free(symbol);
+        symbol = next;
+    }
+    pFixup fixup = image->fixups;
+    while (fixup != nullptr)
+    {
+        pFixup next = fixup->next;
+        free(fixup);
+        fixup = next;
+    }
+    free(image);
+}
+
+void encodeAssemBuffer(pObjectImage image, pAssemBuffer buffer)
+{
+    for (int i = 0; i < buffer->num; i++)
+    {
+        pAssemInstr instr = &buffer->instrs[i];
+        if (instr->deleted)
+            continue;
+        if (instr->kind == ASSEM_LABEL)
+            defineSymbol(image, instr->text);
+        else if (instr->kind == ASSEM_TEXT)
+            encodeText(image, instr->text);
+        else
+        {
+            char *arg[3] = {instr->arg[0], instr->arg[1], instr->arg[2]};
+            encodeInstr(image, instr->op, arg, instr->argNum);
+        }
+    }
+}
+
+void encodeText(pObjectImage image, const char *line)
+{
+    // Directives, a label followed by a directive, and instructions too long for AssemInstr.
+    int length = strlen(line);
+    char *text = (char *)malloc(length + 1);
+    assert(text != nullptr);
+    strcpy(text, line);
+    while (length > 0 && strchr(" \t\n", text[length - 1]) != nullptr)
+        text[--length] = '\0';
+    char *p = text + strspn(text, " \t\n");
+    char *label = nullptr;
+    int nameLen = strspn(p, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.$");
+    if (nameLen > 0 && p[nameLen] == ':')
+    {
+        label = p;
+        p[nameLen] = '\0';
+        p += nameLen + 1;
+        p += strspn(p, " \t");
+    }
+    char *op = p;
+    p += strcspn(p, " \t");
+    if (*p != '\0')
+        *p++ = '\0';
+    p += strspn(p, " \t");
+
+    pSection section = image->current;
+    if (!strcmp(op, ".word"))
+        alignSection(section, 4); // the label moves along with the word
+    if (label != nullptr)
+        defineSymbol(image, label);
+
+    if (op[0] == '\0' || op[0] == '#')
+        ;
+    else if (!strcmp(op, ".data"))
+        image->current = &image->data;
+    else if (!strcmp(op, ".text"))
+        image->current = &image->text;
+    else if (!strcmp(op, ".globl"))
+        getSymbol(image, p)->isGlobal = true;
+    else if (!strcmp(op, ".asciiz") || !strcmp(op, ".ascii"))
+    {
+        assert(*p == '"');
+        for (p++; *p != '"' && *p != '\0'; p++)
+        {
+            char c = *p;
+            if (c == '\\')
+            {
+                c = *++p;
+                c = c == 'n' ? '\n' : c == 't' ? '\t' : c == '0' ? '\0' : c;
+            }
+            emitBytes(section, &c, 1);
+        }
+        if (!strcmp(op, ".asciiz"))
+            emitBytes(section, "", 1);
+    }
+    else if (!strcmp(op, ".word") || !strcmp(op, ".byte"))
+    {
+        for (char *value = strtok(p, ","); value != nullptr; value = strtok(nullptr, ","))
+        {
+            if (op[1] == 'w')
+                emitWord(section, (unsigned int)atoi(value));
+            else
+            {
+                unsigned char c = atoi(value) & 0xff;
+                emitBytes(section, &c, 1);
+            }
+        }
+    }
+    else if (!strcmp(op, ".space"))
+        emitBytes(section, nullptr, atoi(p));
+    else if (!strcmp(op, ".align"))
+        alignSection(section, 1 << atoi(p));
+    else
+    {
+        assert(op[0] != '.');
+        char *arg[3];
+        int argNum = 0;
+        for (char *a = strtok(p, ","); a != nullptr; a = strtok(nullptr, ","))
+        {
+            assert(argNum < 3);
+            a += strspn(a, " \t");
+            arg[argNum++] = a;
+        }
+        encodeInstr(image, op, arg, argNum);
+    }
+    free(text);
+}
+
+static void encodeBranch(pObjectImage image, int opcode, int rs, int rt, const char *label)
+{
+    addFixup(image, FIX_BRANCH, label);
+    emitWord(&image->text, I_TYPE(opcode, rs, rt, 0));
+}
+
+void encodeInstr(pObjectImage image, const char *op, char *arg[], int argNum)
+{
+    // Control transfers are encoded as SPIM runs them, without a nop in a delay slot.
+    pSection text = &image->text;
+    assert(image->current == text);
+    const Encoding *enc = (const Encoding *)bsearch(op, encodings, sizeof(encodings) / sizeof(encodings[0]),
+                                                    sizeof(Encoding), compareEncoding);
+    assert(enc != nullptr);
+    switch (enc->format)
+    {
+    case ENC_R3:
+    {
+        int rt;
+        if (arg[2][0] == '$')
+            rt = getEncodeRegNo(arg[2]);
+        else
+        {
+            loadImmediate(image, REG_AT, atoi(arg[2]));
+            rt = REG_AT;
+        }
+        emitWord(text, (enc->opcode << 26) | R_TYPE(getEncodeRegNo(arg[1]), rt, getEncodeRegNo(arg[0]), 0, enc->funct));
+        break;
+    }
+    case ENC_SHIFT:
+        emitWord(text, R_TYPE(0, getEncodeRegNo(arg[1]), getEncodeRegNo(arg[0]), atoi(arg[2]) & 31, enc->funct));
+        break;
+    case ENC_SHIFTV:
+        emitWord(text, R_TYPE(getEncodeRegNo(arg[2]), getEncodeRegNo(arg[1]), getEncodeRegNo(arg[0]), 0, enc->funct));
+        break;
+    case ENC_MULDIV:
+        assert(argNum == 2);
+        emitWord(text, R_TYPE(getEncodeRegNo(arg[0]), getEncodeRegNo(arg[1]), 0, 0, enc->funct));
+        break;
+    case ENC_MOVE_FROM:
+        emitWord(text, R_TYPE(0, 0, getEncodeRegNo(arg[0]), 0, enc->funct));
+        break;
+    case ENC_JR:
+        emitWord(text, R_TYPE(getEncodeRegNo(arg[0]), 0, 0, 0, enc->funct));
+        break;
+    case ENC_JALR:
+        emitWord(text, R_TYPE(getEncodeRegNo(arg[0]), 0, REG_RA, 0, enc->funct));
+        break;
+    case ENC_SYSCALL:
+        emitWord(text, R_TYPE(0, 0, 0, 0, enc->funct));
+        break;
+    case ENC_IMM:
+    {
+        int rt = getEncodeRegNo(arg[0]), rs = getEncodeRegNo(arg[1]), imm = atoi(arg[2]);
+        if (isImmFit(imm, enc->isUnsigned))
+            emitWord(text, I_TYPE(enc->opcode, rs, rt, imm));
+        else
+        {
+            loadImmediate(image, REG_AT, imm);
+            emitWord(text, R_TYPE(rs, REG_AT, rt, 0, enc->regFunct));
+        }
+        break;
+    }
+    case ENC_LUI:
+        emitWord(text, I_TYPE(enc->opcode, 0, getEncodeRegNo(arg[0]), atoi(arg[1])));
+        break;
+    case ENC_MEM:
+    {
+        int offset, base;
+        boolean isParsed = parseMemArg(arg[1], &offset, &base);
+        assert(isParsed);
+        if (!isImmFit(offset, false))
+        {
+            // lui $at, hi; addu $at, $at, base; op rt, lo($at), lo is sign extended.
+            int hi = (int)(((unsigned int)offset + 0x8000) >> 16);
+            emitWord(text, I_TYPE(0x0f, 0, REG_AT, hi));
+            emitWord(text, R_TYPE(REG_AT, base, REG_AT, 0, 0x21));
+            offset -= (int)((unsigned int)hi << 16);
+            base = REG_AT;
+        }
+        emitWord(text, I_TYPE(enc->opcode, base, getEncodeRegNo(arg[0]), offset));
+        break;
+    }
+    case ENC_BRANCH2:
+        encodeBranch(image, enc->opcode, getEncodeRegNo(arg[0]), getEncodeRegNo(arg[1]), arg[2]);
+        break;
+    case ENC_BRANCH1:
+        encodeBranch(image, enc->opcode, getEncodeRegNo(arg[0]), enc->funct, arg[1]);
+        break;
+    case ENC_JUMP:
+        addFixup(image, FIX_JUMP, arg[0]);
+        emitWord(text, J_TYPE(enc->opcode, 0));
+        break;
+    case ENC_LI:
+        loadImmediate(image, getEncodeRegNo(arg[0]), atoi(arg[1]));
+        break;
+    case ENC_LA:
+    {
+        int rt = getEncodeRegNo(arg[0]);
+        addFixup(image, FIX_HI_LO, arg[1]);
+        emitWord(text, I_TYPE(0x0f, 0, rt, 0));
+        emitWord(text, I_TYPE(0x0d, rt, rt, 0));
+        break;
+    }
+    case ENC_MOVE:
+        emitWord(text, R_TYPE(getEncodeRegNo(arg[1]), 0, getEncodeRegNo(arg[0]), 0, enc->funct));
+        break;
+    case ENC_NOP:
+        emitWord(text, 0);
+        break;
+    case ENC_BRANCH0:
+        encodeBranch(image, enc->opcode, 0, 0, arg[0]);
+        break;
+    case ENC_BRANCHZ:
+        encodeBranch(image, enc->opcode, getEncodeRegNo(arg[0]), 0, arg[1]);
+        break;
+    case ENC_BRANCH_CMP:
+    {
+        int rs = getEncodeRegNo(arg[0]), rt = getEncodeRegNo(arg[1]);
+        emitWord(text, R_TYPE(enc->funct ? rt : rs, enc->funct ? rs : rt, REG_AT, 0, 0x2a));
+        encodeBranch(image, enc->opcode, REG_AT, 0, arg[2]);
+        break;
+    }
+    }
+}
+
+void resolveFixups(pObjectImage image)
+{
+    for (pFixup fixup = image->fixups; fixup != nullptr; fixup = fixup->next)
+    {
+        pSymbol symbol = fixup->symbol;
+        assert(symbol->section != nullptr);
+        unsigned int address = symbol->section->base + symbol->offset;
+        unsigned int pc = image->text.base + fixup->offset;
+        unsigned char *bytes = image->text.bytes + fixup->offset;
+        switch (fixup->kind)
+        {
+        case FIX_BRANCH:
+        {
+            int distance = ((int)address - (int)(pc + 4)) / 4;
+            assert(distance >= -0x8000 && distance < 0x8000);
+            putWord(bytes, getWord(bytes) | (distance & 0xffff));
+            break;
+        }
+        case FIX_JUMP:
+            assert(((pc + 4) & 0xf0000000) == (address & 0xf0000000));
+            putWord(bytes, getWord(bytes) | ((address >> 2) & 0x3ffffff));
+            break;
+        case FIX_HI_LO:
+            // ori zero extends, so the upper half needs no adjustment.
+            putWord(bytes, getWord(bytes) | (address >> 16));
+            putWord(bytes + 4, getWord(bytes + 4) | (address & 0xffff));
+            break;
+        }
+    }
+}
+
+static void writePadding(pWriter writer, int num)
+{
+    for (int i = 0; i < num; i++)
+        writeChar(writer, '\0');
+}
+
+static void putSectionHeader(unsigned char *p, int name, int type, int flags, unsigned int addr,
+                             int offset, int size, int link, int info, int align, int entSize)
+{
+    putWord(p, name);
+    putWord(p + 4, type);
+    putWord(p + 8, flags);
+    putWord(p + 12, addr);
+    putWord(p + 16, offset);
+    putWord(p + 20, size);
+    putWord(p + 24, link);
+    putWord(p + 28, info);
+    putWord(p + 32, align);
+    putWord(p + 36, entSize);
+}
+
+void writeElf(pWriter writer, pObjectImage image)
+{
+    // ELF header, program headers, then text and data each on its own page so that they
+    // can be mapped as they are, then the symbol table, the string tables and the section headers.
+    enum { EHDR_SIZE = 52, PHDR_SIZE = 32, SHDR_SIZE = 40, SYM_SIZE = 16, SECTION_NUM = 6 };
+    static const char shstrtab[] = "\0.text\0.data\0.symtab\0.strtab\0.shstrtab";
+    pSymbol entry = getSymbol(image, "main");
+    assert(entry->section == &image->text);
+
+    // Locals come before globals in the symbol table.
+    int symtabSize = (image->symbolNum + 1) * SYM_SIZE;
+    unsigned char *symtab = (unsigned char *)calloc(symtabSize, 1);
+    int strtabSize = 1;
+    for (pSymbol symbol = image->symbols; symbol != nullptr; symbol = symbol->next)
+        strtabSize += strlen(symbol->name) + 1;
+    char *strtab = (char *)malloc(strtabSize);
+    assert(symtab != nullptr && strtab != nullptr);
+    strtab[0] = '\0';
+    int strPos = 1, symNo = 1, localNum = 1;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (pSymbol symbol = image->symbols; symbol != nullptr; symbol = symbol->next)
+        {
+            if (symbol->isGlobal != (pass == 1))
+                continue;
+            assert(symbol->section != nullptr);
+            unsigned char *p = symtab + symNo++ * SYM_SIZE;
+            boolean isText = symbol->section == &image->text;
+            putWord(p, strPos);
+            putWord(p + 4, symbol->section->base + symbol->offset);
+            p[12] = (symbol->isGlobal << 4) | (isText ? 0 : 1); // NOTYPE or OBJECT
+            putHalf(p + 14, isText ? 1 : 2);
+            strcpy(strtab + strPos, symbol->name);
+            strPos += strlen(symbol->name) + 1;
+        }
+        if (pass == 0)
+            localNum = symNo;
+    }
+
+    int textOffset = PAGE_SIZE;
+    int dataOffset = textOffset + (image->text.size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    int symtabOffset = dataOffset + (image->data.size + 3) / 4 * 4;
+    int strtabOffset = symtabOffset + symtabSize;
+    int shstrtabOffset = strtabOffset + strtabSize;
+    int shOffset = (shstrtabOffset + (int)sizeof(shstrtab) + 3) / 4 * 4;
+
+    unsigned char header[EHDR_SIZE + 2 * PHDR_SIZE] = {0x7f, 'E', 'L', 'F', 1, 1, 1};
+    putHalf(header + 16, 2); // executable
+    putHalf(header + 18, 8); // MIPS
+    putWord(header + 20, 1);
+    putWord(header + 24, entry->section->base + entry->offset);
+    putWord(header + 28, EHDR_SIZE);
+    putWord(header + 32, shOffset);
+    putWord(header + 36, 0x50001000); // MIPS32, o32; still SPIM semantics, see encode.h
+    putHalf(header + 40, EHDR_SIZE);
+    putHalf(header + 42, PHDR_SIZE);
+    putHalf(header + 44, 2);
+    putHalf(header + 46, SHDR_SIZE);
+    putHalf(header + 48, SECTION_NUM);
+    putHalf(header + 50, SECTION_NUM - 1);
+    pSection segments[2] = {&image->text, &image->data};
+    int segmentOffsets[2] = {textOffset, dataOffset};
+    for (int k = 0; k < 2; k++)
+    {
+        unsigned char *p = header + EHDR_SIZE + k * PHDR_SIZE;
+        putWord(p, 1); // PT_LOAD
+        putWord(p + 4, segmentOffsets[k]);
+        putWord(p + 8, segments[k]->base);
+        putWord(p + 12, segments[k]->base);
+        putWord(p + 16, segments[k]->size);
+        putWord(p + 20, segments[k]->size);
+        putWord(p + 24, k == 0 ? 5 : 6); // R+X, R+W
+        putWord(p + 28, PAGE_SIZE);
+    }
+
+    unsigned char sections[SECTION_NUM * SHDR_SIZE] = {0};
+    putSectionHeader(sections + 1 * SHDR_SIZE, 1, 1, 6, image->text.base, textOffset, image->text.size, 0, 0, 4, 0);
+    putSectionHeader(sections + 2 * SHDR_SIZE, 7, 1, 3, image->data.base, dataOffset, image->data.size, 0, 0, 4, 0);
+    putSectionHeader(sections + 3 * SHDR_SIZE, 13, 2, 0, 0, symtabOffset, symtabSize, 4, localNum, 4, SYM_SIZE);
+    putSectionHeader(sections + 4 * SHDR_SIZE, 21, 3, 0, 0, strtabOffset, strtabSize, 0, 0, 1, 0);
+    putSectionHeader(sections + 5 * SHDR_SIZE, 29, 3, 0, 0, shstrtabOffset, sizeof(shstrtab), 0, 0, 1, 0);
+
+    writeBytes(writer, header, sizeof(header));
+    writePadding(writer, textOffset - (int)sizeof(header));
+    writeBytes(writer, image->text.bytes, image->text.size);
+    writePadding(writer, dataOffset - textOffset - image->text.size);
+    writeBytes(writer, image->data.bytes, image->data.size);
+    writePadding(writer, symtabOffset - dataOffset - image->data.size);
+    writeBytes(writer, symtab, symtabSize);
+    writeBytes(writer, strtab, strtabSize);
+    writeBytes(writer, shstrtab, sizeof(shstrtab));
+    writePadding(writer, shOffset - shstrtabOffset - (int)sizeof(shstrtab));
+    writeBytes(writer, sections, sizeof(sections));
+    free(symtab);
+    free(strtab);
+}
+
+pSymbol getSymbol(pObjectImage image, const char *name)
+{
+    unsigned int hash = getSymbolHashCode(name);
+    for (pSymbol p = image->buckets[hash]; p != nullptr; p = p->nextHash)
+    {
+        if (!strcmp(p->name, name))
+            return p;
+    }
+    pSymbol p = (pSymbol)malloc(sizeof(Symbol));
+    assert(p != nullptr);
+    p->name = (char *)malloc(strlen(name) + 1);
+    assert(p->name != nullptr);
+    strcpy(p->name, name);
+    p->section = nullptr;
+    p->offset = 0;
+    p->isGlobal = false;
+    p->nextHash = image->buckets[hash];
+    image->buckets[hash] = p;
+    p->next = nullptr;
+    if (image->lastSymbol == nullptr)
+        image->symbols = p;
+    else
+        image->lastSymbol->next = p;
+    image->lastSymbol = p;
+    image->symbolNum++;
+    return p;
+}
+
+void defineSymbol(pObjectImage image, const char *name)
+{
+    pSymbol symbol = getSymbol(image, name);
+    assert(symbol->section == nullptr);
+    symbol->section = image->current;
+    symbol->offset = image->current->size;
+}
+
+void addFixup(pObjectImage image, int kind, const char *name)
+{
+    // The fixup is for the instruction emitted next.
+    pFixup p = (pFixup)malloc(sizeof(Fixup));
+    assert(p != nullptr);
+    p->kind = kind;
+    p->offset = image->text.size;
+    p->symbol = getSymbol(image, name);
+    p->next = image->fixups;
+    image->fixups = p;
+}
+
+void emitBytes(pSection section, const void *bytes, int len)
+{
+    // bytes == nullptr emits zeros.
+    if (section->size + len > section->capacity)
+    {
+        int capacity = section->capacity == 0 ? PAGE_SIZE : section->capacity;
+        while (capacity < section->size + len)
+            capacity *= 2;
+        section->bytes = (unsigned char *)realloc(section->bytes, capacity);
+        assert(section->bytes != nullptr);
+        section->capacity = capacity;
+    }
+    if (bytes == nullptr)
+        memset(section->bytes + section->size, 0, len);
+    else
+        memcpy(section->bytes + section->size, bytes, len);
+    section->size += len;
+}
+
+void emitWord(pSection section, unsigned int word)
+{
+    unsigned char bytes[4];
+    putWord(bytes, word);
+    emitBytes(section, bytes, 4);
+}
+
+void alignSection(pSection section, int align)
+{
+    if (section->size % align != 0)
+        emitBytes(section, nullptr, align - section->size % align);
+}
+
+void loadImmediate(pObjectImage image, int regNo, int value)
+{
+    // addiu, ori, or lui with an ori for the lower half if it is not zero.
+    if (isImmFit(value, false))
+        emitWord(&image->text, I_TYPE(0x09, 0, regNo, value));
+    else if (isImmFit(value, true))
+        emitWord(&image->text, I_TYPE(0x0d, 0, regNo, value));
+    else
+    {
+        emitWord(&image->text, I_TYPE(0x0f, 0, regNo, (unsigned int)value >> 16));
+        if (value & 0xffff)
+            emitWord(&image->text, I_TYPE(0x0d, regNo, regNo, value));
+    }
+}
+
+int getEncodeRegNo(const char *name)
+{
+    // Decoded by hand, this runs for every operand of the program.
+    assert(name[0] == '$');
+    int k = name[2] - '0';
+    int regNo = -1;
+    switch (name[1])
+    {
+    case 'v':
+        regNo = 2 + k;
+        break;
+    case 'a':
+        regNo = name[2] == 't' ? 1 : 4 + k;
+        break;
+    case 't':
+        regNo = k < 8 ? 8 + k : 16 + k;
+        break;
+    case 's':
+        regNo = name[2] == 'p' ? 29 : 16 + k;
+        break;
+    case 'k':
+        regNo = 26 + k;
+        break;
+    case 'g':
+        regNo = 28;
+        break;
+    case 'f':
+        regNo = 30;
+        break;
+    case 'r':
+        regNo = 31;
+        break;
+    default:
+        regNo = !strcmp(name, "$zero") ? 0 : atoi(name + 1);
+        break;
+    }
+    assert(regNo >= 0 && regNo < REG_NUM);
+    return regNo;
+}
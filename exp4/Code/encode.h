@@ -0,0 +1,85 @@
+#pragma once
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include "peephole.h"
+
+// Addresses of the sections, the same as SPIM and MARS use.
+#define TEXT_BASE 0x00400000
+#define DATA_BASE 0x10010000
+#define PAGE_SIZE 0x1000
+#define SYMBOL_HASH_SIZE 0x1000
+
+typedef struct _section* pSection;
+typedef struct _symbol* pSymbol;
+typedef struct _fixup* pFixup;
+typedef struct _objectImage* pObjectImage;
+
+typedef struct _section {
+    enum {
+        SECTION_TEXT,
+        SECTION_DATA,
+    } kind;
+    unsigned char* bytes;
+    int size, capacity;
+    unsigned int base; // address of bytes[0]
+} Section;
+
+typedef struct _symbol {
+    char* name;
+    pSection section; // nullptr while it is only referenced
+    int offset;
+    boolean isGlobal;
+    pSymbol nextHash; // in the same bucket
+    pSymbol next; // in the order of first appearance
+} Symbol;
+
+// A field of an instruction that holds a label and is filled in once all labels are known.
+typedef struct _fixup {
+    enum {
+        FIX_BRANCH, // 16 bit word offset from the next instruction
+        FIX_JUMP, // 26 bit word address
+        FIX_HI_LO, // lui and ori pair of an absolute address
+    } kind;
+    int offset; // of the instruction in text
+    pSymbol symbol;
+    pFixup next;
+} Fixup;
+
+// The program is encoded one function at a time as the buffers are flushed, branches and
+// jumps to labels not seen yet are recorded as fixups and patched by resolveFixups.
+typedef struct _objectImage {
+    Section text, data;
+    pSection current; // where directives and instructions go
+    pSymbol buckets[SYMBOL_HASH_SIZE];
+    pSymbol symbols, lastSymbol;
+    int symbolNum;
+    pFixup fixups;
+} ObjectImage;
+
+// Set by -binary, the backend then encodes into it instead of printing assembly.
+extern pObjectImage objectImage;
+
+pObjectImage newObjectImage();
+void deleteObjectImage(pObjectImage image);
+void encodeAssemBuffer(pObjectImage image, pAssemBuffer buffer);
+void encodeText(pObjectImage image, const char* line);
+void encodeInstr(pObjectImage image, const char* op, char* arg[], int argNum);
+void resolveFixups(pObjectImage image);
+// ELF32 little endian MIPS executable with .text, .data and a symbol table. It is meant for SPIM and
+// MARS, and assumes the same execution model as the assembly text: branches and jumps have no delay
+// slot, and syscall takes SPIM's service numbers in $v0. It does not run on real MIPS hardware,
+// nor on Linux under qemu-mips.
+void writeElf(pWriter writer, pObjectImage image);
+
+// Helpers
+pSymbol getSymbol(pObjectImage image, const char* name);
+void defineSymbol(pObjectImage image, const char* name);
+void addFixup(pObjectImage image, int kind, const char* name);
+void emitBytes(pSection section, const void* bytes, int len);
+void emitWord(pSection section, unsigned int word);
+void alignSection(pSection section, int align);
+void loadImmediate(pObjectImage image, int regNo, int value);
+int getEncodeRegNo(const char* name);
+
+#endif
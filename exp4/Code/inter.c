@@ -33,7 +33,6 @@ pOperand newOperand(int kind, ...)
     assert(kind >= 0 && kind < 6);
     va_list vaList;
     va_start(vaList, kind);
-    p->loopCond = 0;
     if (kind == OP_CONSTANT)
     {
         p->u.value = va_arg(vaList, int);
@@ -43,6 +42,8 @@ pOperand newOperand(int kind, ...)
         p->u.name = va_arg(vaList, char *); // name should be a new string.
     }
     p->elemType = nullptr;
+    p->width = 4;
+    p->isUnsigned = false;
     return p;
 }
 
@@ -91,25 +92,42 @@ void setElemType(pOperand p, pType elementType)
     p->elemType = elementType;
 }
 
-void printOp(FILE *fp, pOperand op)
+void setWidth(pOperand p, int width)
 {
-    assert(op != nullptr);
-    if (fp == nullptr)
-        fp = stdout;
+    assert(p != nullptr);
+    assert(width == 1 || width == 4);
+    p->width = width;
+}
+
+void setAccess(pOperand p, pType type)
+{
+    // p is the address of a value of type; basic values are accessed with their own width.
+    assert(p != nullptr && type != nullptr);
+    if (type->kind == BASIC)
+    {
+        setWidth(p, getSize(type));
+        p->isUnsigned = type->u.basic == boolType;
+    }
+}
+
+void printOp(pWriter writer, pOperand op)
+{
+    assert(writer != nullptr && op != nullptr);
     if (op->kind == OP_CONSTANT)
     {
-        fprintf(fp, "#%d", op->u.value);
+        writeChar(writer, '#');
+        writeInt(writer, op->u.value);
     }
     else
     {
-        fprintf(fp, "%s", op->u.name);
+        writeString(writer, op->u.name);
     }
 }
 
 // InterCode func
 pInterCode newInterCode(int kind, ...)
 {
-    assert(kind >= 0 && kind <= 20);
+    assert(kind >= 0 && kind <= 21);
     va_list vaList;
     va_start(vaList, kind);
     pInterCode p = (pInterCode)malloc(sizeof(InterCode));
@@ -154,6 +172,11 @@ pInterCode newInterCode(int kind, ...)
         p->u.dec.op = va_arg(vaList, pOperand);
         p->u.dec.size = va_arg(vaList, int);
         break;
+    case IR_COPY: // copy, for struct assignment
+        p->u.copy.dst = va_arg(vaList, pOperand);
+        p->u.copy.src = va_arg(vaList, pOperand);
+        p->u.copy.size = va_arg(vaList, int);
+        break;
     }
     return p;
 }
@@ -210,6 +233,13 @@ void deleteInterCode(pInterCode p)
         p->u.dec.op = nullptr;
         p->u.dec.size = 0;
         break;
+    case IR_COPY: // copy, for struct assignment
+        deleteOperand(p->u.copy.dst);
+        deleteOperand(p->u.copy.src);
+        p->u.copy.dst = nullptr;
+        p->u.copy.src = nullptr;
+        p->u.copy.size = 0;
+        break;
     }
     free(p);
 }
@@ -219,143 +249,156 @@ void printInterCode(FILE *fp, pInterCodeList interCodeList)
     assert(interCodeList != nullptr);
     if (fp == nullptr)
         fp = stdout;
+    pWriter writer = newWriter(fp);
     pInterCodes p = interCodeList->head;
     while (p != nullptr)
     {
-        assert(p->code->kind >= 0 && p->code->kind <= 20);
-        fprintf(fp, "%d: ", p->code->kind);
+        assert(p->code->kind >= 0 && p->code->kind <= 21);
+        writeInt(writer, p->code->kind);
+        writeString(writer, ": ");
         switch (p->code->kind)
         {
         case IR_LABEL: // oneOp
-            fprintf(fp, "LABEL ");
+            writeString(writer, "LABEL ");
             assert(p->code->u.oneOp.op);
-            printOp(fp, p->code->u.oneOp.op);
-            fprintf(fp, " :");
+            printOp(writer, p->code->u.oneOp.op);
+            writeString(writer, " :");
             break;
         case IR_FUNCTION:
-            fprintf(fp, "FUNCTION ");
+            writeString(writer, "FUNCTION ");
             assert(p->code->u.oneOp.op);
-            printOp(fp, p->code->u.oneOp.op);
-            fprintf(fp, " :");
+            printOp(writer, p->code->u.oneOp.op);
+            writeString(writer, " :");
             break;
         case IR_ARG:
         case IR_ARG_ADDR:
-            fprintf(fp, "ARG ");
+            writeString(writer, "ARG ");
             assert(p->code->u.oneOp.op);
-            printOp(fp, p->code->u.oneOp.op);
+            printOp(writer, p->code->u.oneOp.op);
             break;
         case IR_GOTO:
-            fprintf(fp, "GOTO ");
+            writeString(writer, "GOTO ");
             assert(p->code->u.oneOp.op);
-            printOp(fp, p->code->u.oneOp.op);
+            printOp(writer, p->code->u.oneOp.op);
             break;
         case IR_RETURN:
-            fprintf(fp, "RETURN ");
+            writeString(writer, "RETURN ");
             assert(p->code->u.oneOp.op);
-            printOp(fp, p->code->u.oneOp.op);
+            printOp(writer, p->code->u.oneOp.op);
             break;
         case IR_PARAM:
-            fprintf(fp, "PARAM ");
+            writeString(writer, "PARAM ");
             assert(p->code->u.oneOp.op);
-            printOp(fp, p->code->u.oneOp.op);
+            printOp(writer, p->code->u.oneOp.op);
             break;
         case IR_READ:
-            fprintf(fp, "READ ");
+            writeString(writer, "READ ");
             assert(p->code->u.oneOp.op);
-            printOp(fp, p->code->u.oneOp.op);
+            printOp(writer, p->code->u.oneOp.op);
             break;
         case IR_WRITE:
-            fprintf(fp, "WRITE ");
+            writeString(writer, "WRITE ");
             assert(p->code->u.oneOp.op);
-            printOp(fp, p->code->u.oneOp.op);
+            printOp(writer, p->code->u.oneOp.op);
             break;
         case IR_ASSIGN: // assign
             assert(p->code->u.assign.left && p->code->u.assign.right);
-            printOp(fp, p->code->u.assign.left);
-            fprintf(fp, " := ");
-            printOp(fp, p->code->u.assign.right);
+            printOp(writer, p->code->u.assign.left);
+            writeString(writer, " := ");
+            printOp(writer, p->code->u.assign.right);
             break;
         case IR_CALL:
             assert(p->code->u.assign.left && p->code->u.assign.right);
-            printOp(fp, p->code->u.assign.left);
-            fprintf(fp, " := CALL ");
-            printOp(fp, p->code->u.assign.right);
+            printOp(writer, p->code->u.assign.left);
+            writeString(writer, " := CALL ");
+            printOp(writer, p->code->u.assign.right);
             break;
         case IR_GET_ADDR:
             assert(p->code->u.assign.left && p->code->u.assign.right);
-            printOp(fp, p->code->u.assign.left);
-            fprintf(fp, " := &");
-            printOp(fp, p->code->u.assign.right);
+            printOp(writer, p->code->u.assign.left);
+            writeString(writer, " := &");
+            printOp(writer, p->code->u.assign.right);
             break;
         case IR_READ_ADDR:
             assert(p->code->u.assign.left && p->code->u.assign.right);
-            printOp(fp, p->code->u.assign.left);
-            fprintf(fp, " := *");
-            printOp(fp, p->code->u.assign.right);
+            printOp(writer, p->code->u.assign.left);
+            writeString(writer, " := *");
+            printOp(writer, p->code->u.assign.right);
             break;
         case IR_WRITE_ADDR:
             assert(p->code->u.assign.left && p->code->u.assign.right);
-            fprintf(fp, "*");
-            printOp(fp, p->code->u.assign.left);
-            fprintf(fp, " := ");
-            printOp(fp, p->code->u.assign.right);
+            writeString(writer, "*");
+            printOp(writer, p->code->u.assign.left);
+            writeString(writer, " := ");
+            printOp(writer, p->code->u.assign.right);
             break;
         case IR_ADD: // binOp
         case IR_ADD_ADDR:
             assert(p->code->u.binOp.result && p->code->u.binOp.op1 && p->code->u.binOp.op2);
-            printOp(fp, p->code->u.binOp.result);
-            fprintf(fp, " := ");
-            printOp(fp, p->code->u.binOp.op1);
-            fprintf(fp, " + ");
-            printOp(fp, p->code->u.binOp.op2);
+            printOp(writer, p->code->u.binOp.result);
+            writeString(writer, " := ");
+            printOp(writer, p->code->u.binOp.op1);
+            writeString(writer, " + ");
+            printOp(writer, p->code->u.binOp.op2);
             break;
         case IR_SUB:
             assert(p->code->u.binOp.result && p->code->u.binOp.op1 && p->code->u.binOp.op2);
-            printOp(fp, p->code->u.binOp.result);
-            fprintf(fp, " := ");
-            printOp(fp, p->code->u.binOp.op1);
-            fprintf(fp, " - ");
-            printOp(fp, p->code->u.binOp.op2);
+            printOp(writer, p->code->u.binOp.result);
+            writeString(writer, " := ");
+            printOp(writer, p->code->u.binOp.op1);
+            writeString(writer, " - ");
+            printOp(writer, p->code->u.binOp.op2);
             break;
         case IR_MUL:
             assert(p->code->u.binOp.result && p->code->u.binOp.op1 && p->code->u.binOp.op2);
-            printOp(fp, p->code->u.binOp.result);
-            fprintf(fp, " := ");
-            printOp(fp, p->code->u.binOp.op1);
-            fprintf(fp, " * ");
-            printOp(fp, p->code->u.binOp.op2);
+            printOp(writer, p->code->u.binOp.result);
+            writeString(writer, " := ");
+            printOp(writer, p->code->u.binOp.op1);
+            writeString(writer, " * ");
+            printOp(writer, p->code->u.binOp.op2);
             break;
         case IR_DIV:
             assert(p->code->u.binOp.result && p->code->u.binOp.op1 && p->code->u.binOp.op2);
-            printOp(fp, p->code->u.binOp.result);
-            fprintf(fp, " := ");
-            printOp(fp, p->code->u.binOp.op1);
-            fprintf(fp, " / ");
-            printOp(fp, p->code->u.binOp.op2);
+            printOp(writer, p->code->u.binOp.result);
+            writeString(writer, " := ");
+            printOp(writer, p->code->u.binOp.op1);
+            writeString(writer, " / ");
+            printOp(writer, p->code->u.binOp.op2);
             break;
         case IR_IF_GOTO: // ifGoTo
             assert(p->code->u.ifGoto.x && p->code->u.ifGoto.relop && p->code->u.ifGoto.y && p->code->u.ifGoto.z);
-            fprintf(fp, "IF ");
-            printOp(fp, p->code->u.ifGoto.x);
-            fprintf(fp, " ");
-            printOp(fp, p->code->u.ifGoto.relop);
-            fprintf(fp, " ");
-            printOp(fp, p->code->u.ifGoto.y);
-            fprintf(fp, " GOTO ");
-            printOp(fp, p->code->u.ifGoto.z);
+            writeString(writer, "IF ");
+            printOp(writer, p->code->u.ifGoto.x);
+            writeString(writer, " ");
+            printOp(writer, p->code->u.ifGoto.relop);
+            writeString(writer, " ");
+            printOp(writer, p->code->u.ifGoto.y);
+            writeString(writer, " GOTO ");
+            printOp(writer, p->code->u.ifGoto.z);
             break;
         case IR_DEC: // dec, for function
             assert(p->code->u.dec.op);
-            fprintf(fp, "DEC ");
-            printOp(fp, p->code->u.dec.op);
-            fprintf(fp, " %d", p->code->u.dec.size);
+            writeString(writer, "DEC ");
+            printOp(writer, p->code->u.dec.op);
+            writeChar(writer, ' ');
+            writeInt(writer, p->code->u.dec.size);
+            break;
+        case IR_COPY: // copy, for struct assignment
+            assert(p->code->u.copy.dst && p->code->u.copy.src);
+            writeString(writer, "COPY ");
+            printOp(writer, p->code->u.copy.dst);
+            writeString(writer, " ");
+            printOp(writer, p->code->u.copy.src);
+            writeChar(writer, ' ');
+            writeInt(writer, p->code->u.copy.size);
             break;
         default: // Should not reach here.
             assert(0);
         }
-        fprintf(fp, "\n");
+        writeChar(writer, '\n');
         p = p->next;
     }
+    deleteWriter(writer);
 }
 
 // InterCodes func
@@ -369,6 +412,22 @@ pInterCodes newInterCodes(pInterCode code)
     return p;
 }
 
+void removeInterCode(pInterCodeList interCodeList, pInterCodes p)
+{
+    // Unlink p from the list. Operands are shared between codes, so they are kept.
+    assert(p != nullptr);
+    if (p->prev != nullptr)
+        p->prev->next = p->next;
+    else
+        interCodeList->head = p->next;
+    if (p->next != nullptr)
+        p->next->prev = p->prev;
+    if (interCodeList->cur == p)
+        interCodeList->cur = p->prev;
+    free(p->code);
+    free(p);
+}
+
 void deleteInterCodes(pInterCodes p)
 {
     assert(p != nullptr);
@@ -445,7 +504,10 @@ pInterCodeList newInterCodeList()
     p->head = nullptr;
     p->labelNum = 0;
     p->tmpVarNum = 0;
-    p->lastArrayElem = nullptr;
+    p->freeTmp = nullptr;
+    p->freeTmpNum = 0;
+    p->isTmpFree = nullptr;
+    p->tmpCapacity = 0;
     return p;
 }
 
@@ -460,6 +522,8 @@ void deleteInterCodeList(pInterCodeList p)
         deleteInterCodes(ptr);
     }
     p->head = p->cur = nullptr;
+    free(p->freeTmp);
+    free(p->isTmpFree);
     free(p);
 }
 
@@ -485,12 +549,58 @@ void addInterCode(pInterCodeList interCodeList, pInterCodes newCode)
 pOperand newTmp()
 {
     char tName[TLEN] = {'\0'};
-    sprintf(tName, "t%d", interCodeList->tmpVarNum);
-    interCodeList->tmpVarNum += 1;
+    int no = 0;
+    if (interCodeList->freeTmpNum > 0)
+    {
+        // Reuse a temporary whose value has been consumed.
+        interCodeList->freeTmpNum -= 1;
+        no = interCodeList->freeTmp[interCodeList->freeTmpNum];
+        interCodeList->isTmpFree[no] = false;
+    }
+    else
+    {
+        no = interCodeList->tmpVarNum;
+        interCodeList->tmpVarNum += 1;
+        if (no >= interCodeList->tmpCapacity)
+        {
+            interCodeList->tmpCapacity = interCodeList->tmpCapacity ? interCodeList->tmpCapacity * 2 : 0x40;
+            interCodeList->freeTmp = (int *)realloc(interCodeList->freeTmp, interCodeList->tmpCapacity * sizeof(int));
+            interCodeList->isTmpFree = (boolean *)realloc(interCodeList->isTmpFree, interCodeList->tmpCapacity * sizeof(boolean));
+            assert(interCodeList->freeTmp != nullptr && interCodeList->isTmpFree != nullptr);
+        }
+        interCodeList->isTmpFree[no] = false;
+    }
+    sprintf(tName, "t%d", no);
     pOperand p = newOperand(OP_VARIABLE, newString(tName));
     return p;
 }
 
+int getTmpNo(pOperand p)
+{
+    // The number of temporary t<no>, -1 for variables (t_<name>, v_<name>) and the others.
+    if (p == nullptr || (p->kind != OP_VARIABLE && p->kind != OP_ADDRESS))
+        return -1;
+    char *name = p->u.name;
+    if (name[0] != 't' || name[1] < '0' || name[1] > '9')
+        return -1;
+    return atoi(name + 1);
+}
+
+void releaseTmp(pOperand p)
+{
+    // Give the number of a consumed temporary back to newTmp.
+    // Variables, constants and released temporaries are ignored.
+    int no = getTmpNo(p);
+    if (no < 0)
+        return;
+    assert(no < interCodeList->tmpVarNum);
+    if (interCodeList->isTmpFree[no])
+        return;
+    interCodeList->isTmpFree[no] = true;
+    interCodeList->freeTmp[interCodeList->freeTmpNum] = no;
+    interCodeList->freeTmpNum += 1;
+}
+
 pOperand newLabel()
 {
     char tName[TLEN] = {'\0'};
@@ -503,9 +613,12 @@ pOperand newLabel()
 int getSize(pType type)
 {
     // Get the memory size of a variable for array operation.
+    // char and bool take one byte, structure fields are aligned to their own size.
     assert(type != nullptr);
     if (type->kind == BASIC)
     {
+        if (type->u.basic == charType || type->u.basic == boolType)
+            return 1;
         return 4;
     }
     else if (type->kind == ARRAY)
@@ -519,10 +632,13 @@ int getSize(pType type)
         pFieldList p = type->u.structure.field;
         while (p != nullptr)
         {
+            int align = getAlign(p->type);
+            cnt = (cnt + align - 1) / align * align;
             cnt += getSize(p->type);
             p = p->tail;
         }
-        return cnt;
+        // Pad to a whole word, so structures can be copied word by word.
+        return (cnt + 3) / 4 * 4;
     }
     else
     {
@@ -531,17 +647,117 @@ int getSize(pType type)
     }
 }
 
-pType getElement(pType type)
+int getAlign(pType type)
 {
     assert(type != nullptr);
-    if (type->kind == ARRAY)
+    if (type->kind == BASIC)
+        return getSize(type);
+    else if (type->kind == ARRAY)
+        return getAlign(type->u.array.elem);
+    else if (type->kind == STRUCTURE)
+        return 4;
+    assert(0);
+    return 4;
+}
+
+int getFieldOffset(pType structType, char *name)
+{
+    assert(structType != nullptr && structType->kind == STRUCTURE);
+    int offset = 0;
+    pFieldList p = structType->u.structure.field;
+    while (p != nullptr)
     {
-        return getElement(type->u.array.elem);
+        int align = getAlign(p->type);
+        offset = (offset + align - 1) / align * align;
+        if (!strcmp(p->name, name))
+            return offset;
+        offset += getSize(p->type);
+        p = p->tail;
     }
-    else
+    assert(0);
+    return -1;
+}
+
+pType getExpType(pNode node)
+{
+    // Get the type of an lvalue expression, nullptr for the others.
+    // Semantic check has passed here, so the expression is well-typed.
+    assert(node != nullptr);
+    assert(!strcmp(node->name, "Exp"));
+    pNode child = node->children;
+    if (!strcmp(child->name, "LP"))
+    {
+        // Exp -> LP Exp RP
+        return getExpType(child->next);
+    }
+    else if (!strcmp(child->name, "ID") && child->next == nullptr)
+    {
+        // Exp -> ID
+        pItem item = searchFirstTableItem(table, child->val);
+        assert(item != nullptr);
+        return item->field->type;
+    }
+    else if (!strcmp(child->name, "Exp") && !strcmp(child->next->name, "LB"))
     {
-        return type;
+        // Exp -> Exp LB Exp RB
+        pType type = getExpType(child);
+        assert(type != nullptr && type->kind == ARRAY);
+        return type->u.array.elem;
+    }
+    else if (!strcmp(child->name, "Exp") && !strcmp(child->next->name, "DOT"))
+    {
+        // Exp -> Exp DOT ID
+        pType type = getExpType(child);
+        assert(type != nullptr && type->kind == STRUCTURE);
+        pFieldList ptr = type->u.structure.field;
+        while (ptr != nullptr && strcmp(ptr->name, child->next->next->val))
+            ptr = ptr->tail;
+        assert(ptr != nullptr);
+        return ptr->type;
     }
+    return nullptr;
+}
+
+boolean hasSideEffect(pNode node)
+{
+    // Calls (including read and write) and assignments must keep their source order.
+    assert(node != nullptr);
+    assert(!strcmp(node->name, "Exp"));
+    pNode child = node->children;
+    if (!strcmp(child->name, "ID"))
+        return child->next != nullptr;
+    if (child->next != nullptr && !strcmp(child->next->name, "ASSIGNOP"))
+        return true;
+    while (child != nullptr)
+    {
+        if (!strcmp(child->name, "Exp") && hasSideEffect(child))
+            return true;
+        child = child->next;
+    }
+    return false;
+}
+
+int getRegNeed(pNode node)
+{
+    // Sethi-Ullman label: the number of temporaries needed to evaluate the expression.
+    assert(node != nullptr);
+    assert(!strcmp(node->name, "Exp"));
+    pNode child = node->children;
+    if (!strcmp(child->name, "LP") || !strcmp(child->name, "MINUS") || !strcmp(child->name, "NOT"))
+        return getRegNeed(child->next);
+    if (!strcmp(child->name, "Exp"))
+    {
+        pNode op = child->next;
+        if (!strcmp(op->name, "DOT"))
+            return getRegNeed(child);
+        int left = getRegNeed(child);
+        int right = getRegNeed(op->next);
+        if (left == right)
+            return left + 1;
+        return left > right ? left : right;
+    }
+    // ID, INT, FLOAT and calls, whose arguments are evaluated one by one.
+    return 1;
 }
 
 void genInterCodes(pNode node)
@@ -564,11 +780,11 @@ void genInterCode(int kind, ...)
 {
     // Generate inter code for a specific semantic tree node and insert it into interCodeList
     va_list vaList;
-    pOperand tmp = nullptr;
+    pOperand tmp = nullptr, tmp2 = nullptr;
     pOperand result = nullptr, op1 = nullptr, op2 = nullptr, relop = nullptr;
     int size = 0;
     pInterCodes newCode = nullptr;
-    assert(kind >= 0 && kind <= 20);
+    assert(kind >= 0 && kind <= 21);
     va_start(vaList, kind);
     switch (kind)
     {
@@ -590,6 +806,9 @@ void genInterCode(int kind, ...)
         }
         newCode = newInterCodes(newInterCode(kind, op1));
         addInterCode(interCodeList, newCode);
+        // Arguments are read at the call, so their temporaries stay alive until then.
+        if (kind != IR_ARG)
+            releaseTmp(tmp);
         break;
     case IR_ARG_ADDR: // one op, but don't read address
         op1 = va_arg(vaList, pOperand);
@@ -614,6 +833,7 @@ void genInterCode(int kind, ...)
                 tmp = newTmp();
                 genInterCode(IR_READ_ADDR, tmp, op2);
                 genInterCode(IR_WRITE_ADDR, op1, tmp);
+                releaseTmp(tmp);
             }
             else if (op1->kind == OP_ADDRESS)
             {
@@ -651,13 +871,15 @@ void genInterCode(int kind, ...)
         }
         if (op2->kind == OP_ADDRESS)
         {
-            tmp = newTmp();
-            genInterCode(IR_READ_ADDR, tmp, op2);
-            op2 = tmp;
+            tmp2 = newTmp();
+            genInterCode(IR_READ_ADDR, tmp2, op2);
+            op2 = tmp2;
         }
         assert(op1 && op2);
         newCode = newInterCodes(newInterCode(kind, result, op1, op2));
         addInterCode(interCodeList, newCode);
+        releaseTmp(tmp);
+        releaseTmp(tmp2);
         break;
     case IR_ADD_ADDR:
         result = va_arg(vaList, pOperand);
@@ -673,8 +895,6 @@ void genInterCode(int kind, ...)
         op1 = va_arg(vaList, pOperand);
         op2 = va_arg(vaList, pOperand);
         assert(result && op1 && op2 && relop);
-        result->loopCond = 1;
-        op1->loopCond = 1;
         newCode = newInterCodes(newInterCode(kind, result, relop, op1, op2));
         addInterCode(interCodeList, newCode);
         break;
@@ -685,6 +905,29 @@ void genInterCode(int kind, ...)
         newCode = newInterCodes(newInterCode(kind, op1, size));
         addInterCode(interCodeList, newCode);
         break;
+    case IR_COPY: // copy, for struct assignment
+        op1 = va_arg(vaList, pOperand);
+        op2 = va_arg(vaList, pOperand);
+        size = va_arg(vaList, int);
+        assert(size && op1 && op2);
+        // Both sides of a copy are addresses, so take the address of a local struct first.
+        if (op1->kind == OP_VARIABLE)
+        {
+            tmp = newTmp();
+            genInterCode(IR_GET_ADDR, tmp, op1);
+            op1 = tmp;
+        }
+        if (op2->kind == OP_VARIABLE)
+        {
+            tmp2 = newTmp();
+            genInterCode(IR_GET_ADDR, tmp2, op2);
+            op2 = tmp2;
+        }
+        newCode = newInterCodes(newInterCode(kind, op1, op2, size));
+        addInterCode(interCodeList, newCode);
+        releaseTmp(tmp);
+        releaseTmp(tmp2);
+        break;
     default:
         assert(0);
     }
@@ -842,6 +1085,20 @@ void translateDec(pNode node)
         // Dec -> VarDec
         translateVarDec(child, nullptr);
     }
+    else if (child->children->next == nullptr &&
+             searchFirstTableItem(table, child->children->val)->field->type->kind == STRUCTURE)
+    {
+        // Dec -> VarDec ASSIGNOP Exp, for struct
+        pItem item = searchFirstTableItem(table, child->children->val);
+        translateVarDec(child, nullptr);
+        pOperand t2 = newTmp();
+        translateExp(child->next->next, t2);
+        genInterCode(IR_COPY,
+                     newOperand(OP_VARIABLE, newString(item->icname)),
+                     t2,
+                     getSize(item->field->type));
+        releaseTmp(t2);
+    }
     else
     {
         // Dec -> VarDec ASSIGNOP Exp
@@ -850,6 +1107,7 @@ void translateDec(pNode node)
         pOperand t2 = newTmp();
         translateExp(child->next->next, t2);
         genInterCode(IR_ASSIGN, t1, t2);
+        releaseTmp(t2);
     }
 }
 
@@ -876,7 +1134,7 @@ void translateVarDec(pNode node, pOperand place)
             if (place)
             {
                 assert(place->u.name != nullptr);
-                interCodeList->tmpVarNum -= 1;
+                releaseTmp(place);
                 setOperand(place, OP_VARIABLE, newString(item->icname));
             }
         }
@@ -953,6 +1211,7 @@ void translateStmt(pNode node)
             pOperand t1 = newTmp();
             translateExp(exp, t1);
             genInterCode(IR_RETURN, t1);
+            releaseTmp(t1);
         }
     }
     // Stmt -> IF LP Exp RP Stmt
@@ -1068,7 +1327,21 @@ void translateExp(pNode node, pOperand place)
             translateExp(op->next, t2);
             pOperand t1 = newTmp();
             translateExp(child, t1);
-            genInterCode(IR_ASSIGN, t1, t2);
+            pType type = getExpType(child);
+            if (type != nullptr && (type->kind == STRUCTURE || type->kind == ARRAY))
+            {
+                // Struct assignment copies the whole object instead of one word.
+                genInterCode(IR_COPY, t1, t2, getSize(type));
+            }
+            else
+            {
+                genInterCode(IR_ASSIGN, t1, t2);
+                // The value of an assignment is the assigned variable, e.g. x = y = 5.
+                if (place != nullptr)
+                    genInterCode(IR_ASSIGN, place, t1);
+            }
+            releaseTmp(t1);
+            releaseTmp(t2);
         }
         // Exp -> Exp PLUS Exp
         // Exp -> Exp MINUS Exp
@@ -1082,10 +1355,8 @@ void translateExp(pNode node, pOperand place)
             debug("\tExp -> Exp <cal> Exp\n");
             if (place == nullptr)
                 return;
-            pOperand t2 = newTmp();
-            translateExp(op->next, t2);
-            pOperand t1 = newTmp();
-            translateExp(child, t1);
+            pOperand t1 = nullptr, t2 = nullptr;
+            translateBinExp(child, &t1, op->next, &t2);
             if (!strcmp(op->name, "PLUS"))
             {
                 genInterCode(IR_ADD, place, t1, t2);
@@ -1102,6 +1373,8 @@ void translateExp(pNode node, pOperand place)
             {
                 genInterCode(IR_DIV, place, t1, t2);
             }
+            releaseTmp(t1);
+            releaseTmp(t2);
         }
         // Exp -> Exp1 DOT ID
         else if (!strcmp(op->name, "DOT"))
@@ -1124,25 +1397,21 @@ void translateExp(pNode node, pOperand place)
                 genInterCode(IR_GET_ADDR, target, tmp);
             }
             char *idname = op->next->val;
-            pOperand id = newTmp();
-            int offset = 0;
-            // The tmp->u.name should be t_<id_name> or v_<param_name>
-            pItem structItem = strlen(tmp->u.name) > 2 ? searchFirstTableItem(table, tmp->u.name + 2) : nullptr;
-            pType structType = structItem == nullptr ? getElement(interCodeList->lastArrayElem) : getElement(structItem->field->type);
+            pType structType = getExpType(child);
+            assert(structType != nullptr && structType->kind == STRUCTURE);
             pFieldList ptr = structType->u.structure.field;
-            while (ptr)
-            {
-                if (!strcmp(ptr->name, idname))
-                    break;
-                offset += getSize(ptr->type);
+            while (ptr != nullptr && strcmp(ptr->name, idname))
                 ptr = ptr->tail;
-            }
-            pOperand toffset = newOperand(OP_CONSTANT, offset);
+            assert(ptr != nullptr);
+            pOperand toffset = newOperand(OP_CONSTANT, getFieldOffset(structType, idname));
             genInterCode(IR_ADD_ADDR, place, target, toffset);
-            setOperand(place, OP_ADDRESS, newString(id->u.name));
+            place->kind = OP_ADDRESS;
+            releaseTmp(tmp);
+            releaseTmp(target);
             if(ptr->type->kind == ARRAY){
                 place->elemType = ptr->type->u.array.elem;
             }
+            setAccess(place, ptr->type);
         }
         // Exp -> Exp LB Exp RB
         else if (!strcmp(op->name, "LB"))
@@ -1153,7 +1422,6 @@ void translateExp(pNode node, pOperand place)
             pOperand idx = newTmp();
             translateExp(op->next, idx);
             pOperand base = newTmp();
-            char *oldBaseName = newString(base->u.name);
             translateExp(child, base);
             pOperand width = nullptr;
             pOperand offset = newTmp();
@@ -1175,14 +1443,13 @@ void translateExp(pNode node, pOperand place)
             }
             genInterCode(IR_ADD_ADDR, place, target, offset);
             place->kind = OP_ADDRESS;
+            releaseTmp(idx);
+            releaseTmp(offset);
+            releaseTmp(target);
+            releaseTmp(base);
             if (base->elemType->kind == ARRAY)
                 setElemType(place, base->elemType->u.array.elem);
-            if (strcmp(base->u.name, oldBaseName))
-            {
-                interCodeList->lastArrayElem = base->elemType;
-            }
-            free(oldBaseName);
-            oldBaseName = nullptr;
+            setAccess(place, base->elemType);
         }
         else
         {
@@ -1199,6 +1466,7 @@ void translateExp(pNode node, pOperand place)
         translateExp(child->next, t1);
         pOperand zero = newOperand(OP_CONSTANT, 0);
         genInterCode(IR_SUB, place, zero, t1);
+        releaseTmp(t1);
     }
     // Exp -> ID LP Args RP
     //      | ID LP RP
@@ -1217,6 +1485,7 @@ void translateExp(pNode node, pOperand place)
             if (!strcmp(child->val, "write"))
             {
                 genInterCode(IR_WRITE, argList->head->op);
+                releaseTmp(argList->head->op);
             }
             else
             {
@@ -1233,6 +1502,8 @@ void translateExp(pNode node, pOperand place)
                             genInterCode(IR_GET_ADDR, varTmp, argTmp->op);
                             pOperand varTmpCopy = newOperand(OP_ADDRESS, varTmp->u.name);
                             genInterCode(IR_ARG_ADDR, varTmpCopy);
+                            // Released with the other arguments after the call.
+                            argTmp->op = varTmpCopy;
                         }
                         else
                         {
@@ -1257,6 +1528,14 @@ void translateExp(pNode node, pOperand place)
                 {
                     pOperand tmp = newTmp();
                     genInterCode(IR_CALL, tmp, funcTmp);
+                    releaseTmp(tmp);
+                }
+                // Arguments are read at the call, so they can only be reused after it.
+                argTmp = argList->head;
+                while (argTmp != nullptr)
+                {
+                    releaseTmp(argTmp->op);
+                    argTmp = argTmp->next;
                 }
             }
         }
@@ -1277,6 +1556,7 @@ void translateExp(pNode node, pOperand place)
                 {
                     pOperand tmp = newTmp();
                     genInterCode(IR_CALL, tmp, funcTmp);
+                    releaseTmp(tmp);
                 }
             }
         }
@@ -1290,7 +1570,7 @@ void translateExp(pNode node, pOperand place)
         pItem item = searchFirstTableItem(table, child->val);
         assert(item != nullptr);
         // Before the reduction that Exp -> ID, place value should be a tmp value.
-        interCodeList->tmpVarNum -= 1;
+        releaseTmp(place);
         assert(item->icname != nullptr);
         // Do inter-code translation after semantic check, so ID must pre-exit.
         if (item->field->isArg &&
@@ -1314,8 +1594,18 @@ void translateExp(pNode node, pOperand place)
         debug("\tExp -> INT\n");
         if (place == nullptr)
             return;
+        releaseTmp(place);
         setOperand(place, OP_CONSTANT, atoi(child->val));
     }
+    // Exp -> CHAR
+    else if (!strcmp(child->name, "CHAR"))
+    {
+        debug("\tExp -> CHAR\n");
+        if (place == nullptr)
+            return;
+        releaseTmp(place);
+        setOperand(place, OP_CONSTANT, (int)child->val[0]);
+    }
     else
     {
         // Exception, should not reach here.
@@ -1323,6 +1613,26 @@ void translateExp(pNode node, pOperand place)
     }
 }
 
+void translateBinExp(pNode left, pOperand *t1, pNode right, pOperand *t2)
+{
+    // Evaluate the operand that needs more temporaries first, so fewer of them are live at once.
+    // Operands with side effects are evaluated from left to right.
+    if (!hasSideEffect(left) && !hasSideEffect(right) && getRegNeed(right) > getRegNeed(left))
+    {
+        *t2 = newTmp();
+        translateExp(right, *t2);
+        *t1 = newTmp();
+        translateExp(left, *t1);
+    }
+    else
+    {
+        *t1 = newTmp();
+        translateExp(left, *t1);
+        *t2 = newTmp();
+        translateExp(right, *t2);
+    }
+}
+
 void translateCond(pNode node, pOperand labelTrue, pOperand labelFalse)
 {
     assert(node != nullptr);
@@ -1351,25 +1661,27 @@ void translateCond(pNode node, pOperand labelTrue, pOperand labelFalse)
     else if (child->next != nullptr && !strcmp(child->next->name, "RELOP"))
     {
         debug("\tRELOP\n");
-        pOperand t1 = newTmp();
-        pOperand t2 = newTmp();
-        translateExp(child, t1);
-        translateExp(child->next->next, t2);
+        pOperand t1 = nullptr, t2 = nullptr;
+        translateBinExp(child, &t1, child->next->next, &t2);
         pOperand relop = newOperand(OP_RELOP, newString(child->next->val));
         if (t1->kind == OP_ADDRESS)
         {
             pOperand tmp = newTmp();
             genInterCode(IR_READ_ADDR, tmp, t1);
+            releaseTmp(t1);
             t1 = tmp;
         }
         if (t2->kind == OP_ADDRESS)
         {
             pOperand tmp = newTmp();
             genInterCode(IR_READ_ADDR, tmp, t2);
+            releaseTmp(t2);
             t2 = tmp;
         }
         genInterCode(IR_IF_GOTO, t1, relop, t2, labelTrue);
         genInterCode(IR_GOTO, labelFalse);
+        releaseTmp(t1);
+        releaseTmp(t2);
     }
     // Exp -> Exp AND Exp
     else if (child->next != nullptr && !strcmp(child->next->name, "AND"))
@@ -1401,10 +1713,12 @@ void translateCond(pNode node, pOperand labelTrue, pOperand labelFalse)
         {
             pOperand tmp = newTmp();
             genInterCode(IR_READ_ADDR, tmp, t1);
+            releaseTmp(t1);
             t1 = tmp;
         }
         genInterCode(IR_IF_GOTO, t1, relop, t2, labelTrue);
         genInterCode(IR_GOTO, labelFalse);
+        releaseTmp(t1);
     }
 }
 
@@ -3,6 +3,7 @@
 #define INTER_H
 #include "node.h"
 #include "semantic.h"
+#include "writer.h"
 #include <string.h>
 
 #define debug(a) //printf(a)
@@ -31,9 +32,10 @@ typedef struct _operand {
         char* name;
     } u;
 
-    int loopCond; // whther the variable is in a while condition statement
-
     pType elemType;
+
+    int width; // bytes read or written through an address, 1 for char and bool elements
+    boolean isUnsigned; // bool elements are loaded with lbu
 } Operand;
 
 typedef struct _interCode {
@@ -59,6 +61,7 @@ typedef struct _interCode {
         IR_ADD_ADDR,
         IR_IF_GOTO, //ifGoTo
         IR_DEC, // dec, for function
+        IR_COPY, // copy, for struct assignment
     } kind;
 
     union {
@@ -78,6 +81,10 @@ typedef struct _interCode {
             pOperand op;
             int size;
         } dec;
+        struct {
+            pOperand dst, src; // both hold addresses
+            int size;
+        } copy;
     } u;
 } InterCode;
 
@@ -99,9 +106,12 @@ typedef struct _argList {
 typedef struct _interCodeList {
     pInterCodes head;
     pInterCodes cur;
-    pType lastArrayElem; // For struct array
     int tmpVarNum;
     int labelNum;
+    int* freeTmp; // Released temporary numbers, reused by newTmp
+    int freeTmpNum;
+    boolean* isTmpFree; // isTmpFree[i] when t<i> is in freeTmp
+    int tmpCapacity;
 } InterCodeList;
 
 extern int interError;
@@ -113,7 +123,8 @@ void deleteOperand(pOperand p);
 void setOperand(pOperand p, int kind, ...);
 void setElemType(pOperand p, pType elementType);
 void setWidth(pOperand p, int width);
-void printOp(FILE* fp, pOperand op);
+void setAccess(pOperand p, pType type);
+void printOp(pWriter writer, pOperand op);
 
 // InterCode func
 pInterCode newInterCode(int kind, ...);
@@ -135,15 +146,24 @@ void addArg(pArgList argList, pArg arg);
 pInterCodeList newInterCodeList();
 void deleteInterCodeList(pInterCodeList p);
 void addInterCode(pInterCodeList interCodeList, pInterCodes newCode);
+void removeInterCode(pInterCodeList interCodeList, pInterCodes p);
 
 // traverse func
 pOperand newTmp();
+void releaseTmp(pOperand p);
+int getTmpNo(pOperand p);
 pOperand newLabel();
 int getSize(pType type);
+int getAlign(pType type);
+int getFieldOffset(pType structType, char *name);
 pType getElement(pType type);
+pType getExpType(pNode node);
+boolean hasSideEffect(pNode node);
+int getRegNeed(pNode node);
 void genInterCodes(pNode node);
 void genInterCode(int kind, ...);
 void translateExp(pNode node, pOperand place);
+void translateBinExp(pNode left, pOperand *t1, pNode right, pOperand *t2);
 void translateArgs(pNode node, pArgList argList);
 void translateCond(pNode node, pOperand labelTrue, pOperand labelFalse);
 void translateVarDec(pNode node, pOperand place);
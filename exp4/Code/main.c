@@ -1,10 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "syntax.tab.h"
 #include "type.h"
 #include "node.h"
 #include "semantic.h"
 #include "inter.h"
 #include "assembly.h"
+#include "optimize.h"
+#include "schedule.h"
+#include "x86.h"
 
 /*extern*/
 extern pNode root;
@@ -18,6 +22,14 @@ pTable table = nullptr;
 pInterCodeList interCodeList = nullptr;
 int interError = 0;
 
+int optLevel = 0;
+boolean printStats = false;
+boolean bufferOutput = false;
+int jobNum = 1;
+boolean emitComments = false;
+boolean binaryOutput = false;
+boolean x86Output = false;
+
 int main(int argc, char** argv){
     if (argc <= 2) return 2;
     FILE* fr = fopen(argv[1], "r");
@@ -26,7 +38,27 @@ int main(int argc, char** argv){
         return 1;
     }
 
-    FILE* fw = fopen(argv[2], "wt+");
+    // parser <input> <output> [-O<level>] [-stats] [-buffer-output] [-j<threads>] [-comments] [-binary] [-x86] [-latency=<load>,<mul>,<div>]
+    for (int i = 3; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] == 'O')
+            optLevel = atoi(argv[i] + 2);
+        else if (argv[i][0] == '-' && argv[i][1] == 'j')
+            jobNum = atoi(argv[i] + 2);
+        else if (!strcmp(argv[i], "-stats"))
+            printStats = true;
+        else if (!strcmp(argv[i], "-buffer-output"))
+            bufferOutput = true;
+        else if (!strcmp(argv[i], "-comments"))
+            emitComments = true;
+        else if (!strcmp(argv[i], "-binary"))
+            binaryOutput = true;
+        else if (!strcmp(argv[i], "-x86"))
+            x86Output = true;
+        else if (!strncmp(argv[i], "-latency=", 9))
+            sscanf(argv[i] + 9, "%d,%d,%d", &latencyModel.load, &latencyModel.mul, &latencyModel.div);
+    }
+
+    FILE* fw = fopen(argv[2], binaryOutput ? "wb+" : "wt+");
     if (!fw) {
         perror(argv[2]);
         return 1;
@@ -48,9 +80,15 @@ int main(int argc, char** argv){
         traverseTree(root);
         interCodeList = newInterCodeList();
         genInterCodes(root);
+        if(optLevel >= 1){
+            optimizeInterCode(interCodeList);
+        }
         //printInterCode(fw_inter, interCodeList);
         if(!interError){
-            genAssemblyCode(fw);
+            if (x86Output)
+                genX86Code(fw);
+            else
+                genAssemblyCode(fw);
         }
         deleteTable(table);
     }
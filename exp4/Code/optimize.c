@@ -0,0 +1,259 @@
+#include "optimize.h"
+
+static inline char *newString(char *src)
+{
+    if (src == nullptr)
+        return nullptr;
+    int length = strlen(src) + 1;
+    char *p = (char *)malloc(sizeof(char) * length);
+    assert(p != nullptr);
+    strncpy(p, src, length);
+    return p;
+}
+
+void optimizeInterCode(pInterCodeList interCodeList)
+{
+    assert(interCodeList != nullptr);
+    int *labelRef = countLabelRef(interCodeList);
+    removeRedundantJumps(interCodeList, labelRef);
+    removeDeadLabels(interCodeList, labelRef);
+    // Labels are gone now, so more definitions are followed directly by their copy.
+    foldCopies(interCodeList);
+    free(labelRef);
+}
+
+int *countLabelRef(pInterCodeList interCodeList)
+{
+    // labelRef[i] is the number of jumps to label<i>.
+    int *labelRef = (int *)calloc(interCodeList->labelNum + 1, sizeof(int));
+    assert(labelRef != nullptr);
+    pInterCodes p = interCodeList->head;
+    while (p != nullptr)
+    {
+        if (p->code->kind == IR_GOTO)
+            labelRef[getLabelNo(p->code->u.oneOp.op)]++;
+        else if (p->code->kind == IR_IF_GOTO)
+            labelRef[getLabelNo(p->code->u.ifGoto.z)]++;
+        p = p->next;
+    }
+    return labelRef;
+}
+
+void removeRedundantJumps(pInterCodeList interCodeList, int *labelRef)
+{
+    /*
+    GOTO L; LABEL L                     =>  LABEL L
+    IF x op y GOTO L; LABEL L           =>  LABEL L
+    IF x op y GOTO L1; GOTO L2; LABEL L1 =>  IF x !op y GOTO L2; LABEL L1
+    */
+    pInterCodes p = interCodeList->head;
+    while (p != nullptr)
+    {
+        pInterCodes next = p->next;
+        pInterCode code = p->code;
+        if (code->kind == IR_GOTO && isLabelFollowing(p, code->u.oneOp.op))
+        {
+            labelRef[getLabelNo(code->u.oneOp.op)]--;
+            removeInterCode(interCodeList, p);
+        }
+        else if (code->kind == IR_IF_GOTO && isLabelFollowing(p, code->u.ifGoto.z))
+        {
+            // Operands of a condition have no side effect.
+            labelRef[getLabelNo(code->u.ifGoto.z)]--;
+            removeInterCode(interCodeList, p);
+        }
+        else if (code->kind == IR_IF_GOTO && next != nullptr &&
+                 next->code->kind == IR_GOTO && isLabelFollowing(next, code->u.ifGoto.z))
+        {
+            labelRef[getLabelNo(code->u.ifGoto.z)]--;
+            code->u.ifGoto.relop = invertRelop(code->u.ifGoto.relop);
+            code->u.ifGoto.z = next->code->u.oneOp.op;
+            next = next->next;
+            removeInterCode(interCodeList, p->next);
+        }
+        p = next;
+    }
+}
+
+void removeDeadLabels(pInterCodeList interCodeList, int *labelRef)
+{
+    pInterCodes p = interCodeList->head;
+    while (p != nullptr)
+    {
+        pInterCodes next = p->next;
+        if (p->code->kind == IR_LABEL && labelRef[getLabelNo(p->code->u.oneOp.op)] == 0)
+            removeInterCode(interCodeList, p);
+        p = next;
+    }
+}
+
+void foldCopies(pInterCodeList interCodeList)
+{
+    /*
+    Walk backwards and track which temporaries are live.
+    t1 := <expr>; x := t1  =>  x := <expr>, when t1 is dead after the copy.
+    Chains such as t2 := a + b; t1 := t2; x := t1 collapse one step at a time.
+    Temporaries never live across a label back to an earlier point, so the
+    straight-line liveness is enough here.
+    */
+    boolean *live = (boolean *)calloc(interCodeList->tmpVarNum + 1, sizeof(boolean));
+    assert(live != nullptr);
+    pInterCodes p = interCodeList->cur;
+    while (p != nullptr)
+    {
+        pInterCodes prev = p->prev;
+        pInterCode code = p->code;
+        if (code->kind == IR_ASSIGN && prev != nullptr &&
+            code->u.assign.left->kind == OP_VARIABLE &&
+            code->u.assign.right->kind == OP_VARIABLE)
+        {
+            int no = getTmpNo(code->u.assign.right);
+            pOperand *def = getDefSlot(prev->code);
+            if (no >= 0 && !live[no] && def != nullptr &&
+                (*def)->kind == OP_VARIABLE && getTmpNo(*def) == no)
+            {
+                *def = code->u.assign.left;
+                removeInterCode(interCodeList, p);
+                // The merged code may be the copy of another definition.
+                p = prev;
+                continue;
+            }
+        }
+        if (code->kind == IR_FUNCTION)
+            memset(live, 0, (interCodeList->tmpVarNum + 1) * sizeof(boolean));
+        else
+            markLive(live, code);
+        p = prev;
+    }
+    free(live);
+}
+
+int getLabelNo(pOperand op)
+{
+    assert(op != nullptr && op->kind == OP_LABEL);
+    assert(!strncmp(op->u.name, "label", 5));
+    return atoi(op->u.name + 5);
+}
+
+boolean isLabelFollowing(pInterCodes p, pOperand label)
+{
+    // Whether label is among the labels right after p.
+    p = p->next;
+    while (p != nullptr && p->code->kind == IR_LABEL)
+    {
+        if (!strcmp(p->code->u.oneOp.op->u.name, label->u.name))
+            return true;
+        p = p->next;
+    }
+    return false;
+}
+
+pOperand invertRelop(pOperand relop)
+{
+    assert(relop != nullptr && relop->kind == OP_RELOP);
+    const char *from[] = {"==", "!=", "<", ">=", ">", "<="};
+    const char *to[] = {"!=", "==", ">=", "<", "<=", ">"};
+    for (int i = 0; i < 6; i++)
+    {
+        if (!strcmp(relop->u.name, from[i]))
+            return newOperand(OP_RELOP, newString((char *)to[i]));
+    }
+    assert(0);
+    return nullptr;
+}
+
+pOperand *getDefSlot(pInterCode code)
+{
+    // The operand defined by code, if the definition can be retargeted to another variable.
+    switch (code->kind)
+    {
+    case IR_READ:
+        return &code->u.oneOp.op;
+    case IR_ASSIGN:
+    case IR_CALL:
+    case IR_READ_ADDR:
+        return &code->u.assign.left;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+        return &code->u.binOp.result;
+    default:
+        return nullptr;
+    }
+}
+
+void markLive(boolean *live, pInterCode code)
+{
+    // Update liveness from after code to before code: kill the definition, then add the uses.
+    int no = -1;
+    switch (code->kind)
+    {
+    case IR_READ:
+    case IR_PARAM:
+        no = getTmpNo(code->u.oneOp.op);
+        if (no >= 0)
+            live[no] = false;
+        break;
+    case IR_ARG:
+    case IR_ARG_ADDR:
+    case IR_RETURN:
+    case IR_WRITE:
+        no = getTmpNo(code->u.oneOp.op);
+        if (no >= 0)
+            live[no] = true;
+        break;
+    case IR_ASSIGN:
+    case IR_CALL:
+    case IR_GET_ADDR:
+    case IR_READ_ADDR:
+        no = getTmpNo(code->u.assign.left);
+        if (no >= 0)
+            live[no] = false;
+        no = getTmpNo(code->u.assign.right);
+        if (no >= 0)
+            live[no] = true;
+        break;
+    case IR_WRITE_ADDR:
+        no = getTmpNo(code->u.assign.left);
+        if (no >= 0)
+            live[no] = true;
+        no = getTmpNo(code->u.assign.right);
+        if (no >= 0)
+            live[no] = true;
+        break;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_ADD_ADDR:
+        no = getTmpNo(code->u.binOp.result);
+        if (no >= 0)
+            live[no] = false;
+        no = getTmpNo(code->u.binOp.op1);
+        if (no >= 0)
+            live[no] = true;
+        no = getTmpNo(code->u.binOp.op2);
+        if (no >= 0)
+            live[no] = true;
+        break;
+    case IR_IF_GOTO:
+        no = getTmpNo(code->u.ifGoto.x);
+        if (no >= 0)
+            live[no] = true;
+        no = getTmpNo(code->u.ifGoto.y);
+        if (no >= 0)
+            live[no] = true;
+        break;
+    case IR_COPY:
+        no = getTmpNo(code->u.copy.dst);
+        if (no >= 0)
+            live[no] = true;
+        no = getTmpNo(code->u.copy.src);
+        if (no >= 0)
+            live[no] = true;
+        break;
+    default: // IR_LABEL, IR_FUNCTION, IR_GOTO, IR_DEC
+        break;
+    }
+}
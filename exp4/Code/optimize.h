@@ -0,0 +1,39 @@
+#pragma once
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "inter.h"
+
+// -O0: translate the inter code as it is.
+// -O1: clean up the inter code before generating assembly, and allocate registers by linear scan.
+// -O2: allocate registers by graph coloring instead.
+extern int optLevel;
+// -stats: report what the optimizations did on stderr.
+extern boolean printStats;
+// -buffer-output: collect the output of write in memory and print it with few syscalls.
+extern boolean bufferOutput;
+// -j<n>: translate the functions to assembly on n threads, the output is the same.
+extern int jobNum;
+// -comments: annotate the assembly with where each variable lives on the stack.
+extern boolean emitComments;
+// -binary: encode the instructions into a MIPS ELF32 executable instead of printing assembly.
+extern boolean binaryOutput;
+// -x86: translate to x86-64 assembly for the GNU assembler instead of MIPS, see x86.h.
+extern boolean x86Output;
+
+void optimizeInterCode(pInterCodeList interCodeList);
+
+// Passes, each one is a linear scan over interCodeList.
+int *countLabelRef(pInterCodeList interCodeList);
+void removeRedundantJumps(pInterCodeList interCodeList, int *labelRef);
+void removeDeadLabels(pInterCodeList interCodeList, int *labelRef);
+void foldCopies(pInterCodeList interCodeList);
+
+// Helpers
+int getLabelNo(pOperand op);
+boolean isLabelFollowing(pInterCodes p, pOperand label);
+pOperand invertRelop(pOperand relop);
+pOperand *getDefSlot(pInterCode code);
+void markLive(boolean *live, pInterCode code);
+
+#endif
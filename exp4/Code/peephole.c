@@ -0,0 +1,467 @@
+#include "peephole.h"
+#include "assembly.h"
+
+extern const char *REG_NAME[REG_NUM];
+
+__thread pAssemBuffer assemBuffer = nullptr;
+
+// Rules run in this order, the table ends with a null name.
+__thread PeepholeRule peepholeRules[] = {
+    {"self-move", removeSelfMoves, 0},
+    {"store-load", forwardStores, 0},
+    {"jump-to-next", removeJumpsToNext, 0},
+    {"jump-thread", threadJumps, 0},
+    {"branch-over-jump", invertBranchOverJump, 0},
+    {"redundant-li", removeRedundantLi, 0},
+    {nullptr, nullptr, 0},
+};
+
+static inline char *newString(const char *src)
+{
+    int length = strlen(src) + 1;
+    char *p = (char *)malloc(sizeof(char) * length);
+    assert(p != nullptr);
+    strncpy(p, src, length);
+    return p;
+}
+
+pAssemBuffer newAssemBuffer()
+{
+    pAssemBuffer p = (pAssemBuffer)malloc(sizeof(AssemBuffer));
+    assert(p != nullptr);
+    p->num = 0;
+    p->capacity = 0x100;
+    p->instrs = (pAssemInstr)malloc(p->capacity * sizeof(AssemInstr));
+    assert(p->instrs != nullptr);
+    return p;
+}
+
+void deleteAssemBuffer(pAssemBuffer buffer)
+{
+    assert(buffer != nullptr);
+    clearAssemBuffer(buffer);
+    free(buffer->instrs);
+    free(buffer);
+}
+
+void clearAssemBuffer(pAssemBuffer buffer)
+{
+    for (int i = 0; i < buffer->num; i++)
+        free(buffer->instrs[i].text);
+    buffer->num = 0;
+}
+
+void emitCode(const char *format, ...)
+{
+    // Format like fprintf, then split into lines.
+    char line[0x200];
+    char *text = line;
+    va_list vaList;
+    va_start(vaList, format);
+    int length = vsnprintf(line, sizeof(line), format, vaList);
+    va_end(vaList);
+    if (length >= (int)sizeof(line))
+    {
+        text = (char *)malloc(length + 1);
+        assert(text != nullptr);
+        va_start(vaList, format);
+        vsnprintf(text, length + 1, format, vaList);
+        va_end(vaList);
+    }
+    char *begin = text;
+    for (char *p = text; *p; p++)
+    {
+        if (*p == '\n')
+        {
+            *p = '\0';
+            addAssemLine(assemBuffer, begin);
+            begin = p + 1;
+        }
+    }
+    if (*begin)
+        addAssemLine(assemBuffer, begin);
+    if (text != line)
+        free(text);
+}
+
+void addAssemLine(pAssemBuffer buffer, const char *line)
+{
+    if (buffer->num == buffer->capacity)
+    {
+        buffer->capacity *= 2;
+        buffer->instrs = (pAssemInstr)realloc(buffer->instrs, buffer->capacity * sizeof(AssemInstr));
+        assert(buffer->instrs != nullptr);
+    }
+    pAssemInstr instr = &buffer->instrs[buffer->num++];
+    instr->deleted = false;
+    instr->argNum = 0;
+    instr->text = nullptr;
+    const char *p = line;
+    while (*p == ' ')
+        p++;
+    int length = strlen(line);
+    if (p == line && length > 1 && line[length - 1] == ':' && strchr(line, ' ') == nullptr)
+    {
+        instr->kind = ASSEM_LABEL;
+        instr->text = newString(line);
+        instr->text[length - 1] = '\0';
+        return;
+    }
+    if (p != line && *p != '#' && *p != '\0')
+    {
+        // op arg0, arg1, arg2
+        int opLen = strcspn(p, " ");
+        if (opLen < (int)sizeof(instr->op))
+        {
+            instr->kind = ASSEM_INSTR;
+            strncpy(instr->op, p, opLen);
+            instr->op[opLen] = '\0';
+            p += opLen;
+            boolean fits = true;
+            while (*p != '\0' && fits)
+            {
+                while (*p == ' ' || *p == ',')
+                    p++;
+                int argLen = strcspn(p, ",");
+                while (argLen > 0 && p[argLen - 1] == ' ')
+                    argLen--;
+                if (instr->argNum == 3 || argLen >= ASSEM_ARG_LEN)
+                    fits = false;
+                else
+                {
+                    strncpy(instr->arg[instr->argNum], p, argLen);
+                    instr->arg[instr->argNum++][argLen] = '\0';
+                    p += strcspn(p, ",");
+                }
+            }
+            if (fits)
+                return;
+        }
+    }
+    instr->kind = ASSEM_TEXT;
+    instr->argNum = 0;
+    instr->text = newString(line);
+}
+
+void printAssemBuffer(pWriter writer, pAssemBuffer buffer)
+{
+    for (int i = 0; i < buffer->num; i++)
+    {
+        pAssemInstr instr = &buffer->instrs[i];
+        if (instr->deleted)
+            continue;
+        if (instr->kind == ASSEM_LABEL)
+        {
+            writeString(writer, instr->text);
+            writeString(writer, ":\n");
+        }
+        else if (instr->kind == ASSEM_TEXT)
+        {
+            writeString(writer, instr->text);
+            writeChar(writer, '\n');
+        }
+        else
+        {
+            writeString(writer, "  ");
+            writeString(writer, instr->op);
+            for (int k = 0; k < instr->argNum; k++)
+            {
+                writeString(writer, k == 0 ? " " : ", ");
+                writeString(writer, instr->arg[k]);
+            }
+            writeChar(writer, '\n');
+        }
+    }
+}
+
+void runPeephole(pAssemBuffer buffer)
+{
+    // Rules may enable each other, run them until nothing fires, a few rounds at most.
+    for (int round = 0; round < 8; round++)
+    {
+        int fired = 0;
+        for (pPeepholeRule rule = peepholeRules; rule->name != nullptr; rule++)
+        {
+            int n = rule->apply(buffer);
+            rule->fired += n;
+            fired += n;
+        }
+        // Drop deleted lines.
+        int num = 0;
+        for (int i = 0; i < buffer->num; i++)
+        {
+            if (buffer->instrs[i].deleted)
+                free(buffer->instrs[i].text);
+            else
+                buffer->instrs[num++] = buffer->instrs[i];
+        }
+        buffer->num = num;
+        if (fired == 0)
+            break;
+    }
+}
+
+void printPeepholeStats(FILE *fp)
+{
+    for (pPeepholeRule rule = peepholeRules; rule->name != nullptr; rule++)
+        fprintf(fp, "peephole %s: %d\n", rule->name, rule->fired);
+}
+
+int removeSelfMoves(pAssemBuffer buffer)
+{
+    // move r, r  =>
+    int fired = 0;
+    for (int i = 0; i < buffer->num; i++)
+    {
+        pAssemInstr instr = &buffer->instrs[i];
+        if (!instr->deleted && instr->kind == ASSEM_INSTR && !strcmp(instr->op, "move") &&
+            !strcmp(instr->arg[0], instr->arg[1]))
+        {
+            instr->deleted = true;
+            fired++;
+        }
+    }
+    return fired;
+}
+
+int forwardStores(pAssemBuffer buffer)
+{
+    /*
+    sw r, A; lw r, A   =>  sw r, A
+    sw r, A; lw s, A   =>  sw r, A; move s, r
+    lw r, A; sw r, A   =>  lw r, A, unless A is based on r
+    */
+    int fired = 0;
+    for (int i = 0; i < buffer->num; i++)
+    {
+        pAssemInstr first = &buffer->instrs[i];
+        if (first->deleted || first->kind != ASSEM_INSTR ||
+            (strcmp(first->op, "sw") && strcmp(first->op, "lw")))
+            continue;
+        int j = nextInstr(buffer, i);
+        if (j < 0 || buffer->instrs[j].kind != ASSEM_INSTR)
+            continue;
+        pAssemInstr second = &buffer->instrs[j];
+        if (first->argNum != 2 || second->argNum != 2 || strcmp(first->arg[1], second->arg[1]))
+            continue;
+        if (!strcmp(first->op, "sw") && !strcmp(second->op, "lw"))
+        {
+            if (!strcmp(first->arg[0], second->arg[0]))
+                second->deleted = true;
+            else
+            {
+                strcpy(second->op, "move");
+                strcpy(second->arg[1], first->arg[0]);
+            }
+            fired++;
+        }
+        else if (!strcmp(first->op, "lw") && !strcmp(second->op, "sw") &&
+                 !strcmp(first->arg[0], second->arg[0]))
+        {
+            char base[ASSEM_ARG_LEN + 2];
+            snprintf(base, sizeof(base), "(%s)", first->arg[0]);
+            if (strstr(first->arg[1], base) == nullptr)
+            {
+                second->deleted = true;
+                fired++;
+            }
+        }
+    }
+    return fired;
+}
+
+static boolean isLabelAhead(pAssemBuffer buffer, int i, const char *label)
+{
+    // Whether label is among the labels between i and the next instruction.
+    for (int k = i + 1; k < buffer->num; k++)
+    {
+        pAssemInstr instr = &buffer->instrs[k];
+        if (instr->deleted || instr->kind == ASSEM_TEXT)
+            continue;
+        if (instr->kind == ASSEM_INSTR)
+            return false;
+        if (!strcmp(instr->text, label))
+            return true;
+    }
+    return false;
+}
+
+int removeJumpsToNext(pAssemBuffer buffer)
+{
+    // j L; L:  =>  L:
+    int fired = 0;
+    for (int i = 0; i < buffer->num; i++)
+    {
+        pAssemInstr instr = &buffer->instrs[i];
+        if (!instr->deleted && instr->kind == ASSEM_INSTR && !strcmp(instr->op, "j") &&
+            isLabelAhead(buffer, i, instr->arg[0]))
+        {
+            instr->deleted = true;
+            fired++;
+        }
+    }
+    return fired;
+}
+
+static int compareLabel(const void *a, const void *b)
+{
+    return strcmp(((pAssemInstr)a)->text, ((pAssemInstr)b)->text);
+}
+
+int threadJumps(pAssemBuffer buffer)
+{
+    // A jump or a branch to L, where L: j L2, goes to L2 directly.
+    // labels[k].text is a label, labels[k].arg[0] the target of the jump right after it, or "".
+    pAssemInstr labels = (pAssemInstr)malloc((buffer->num + 1) * sizeof(AssemInstr));
+    assert(labels != nullptr);
+    int labelNum = 0;
+    for (int k = 0; k < buffer->num; k++)
+    {
+        if (buffer->instrs[k].deleted || buffer->instrs[k].kind != ASSEM_LABEL)
+            continue;
+        int next = nextInstr(buffer, k);
+        while (next >= 0 && buffer->instrs[next].kind == ASSEM_LABEL)
+            next = nextInstr(buffer, next);
+        labels[labelNum].text = buffer->instrs[k].text;
+        labels[labelNum].arg[0][0] = '\0';
+        if (next >= 0 && !strcmp(buffer->instrs[next].op, "j"))
+            strcpy(labels[labelNum].arg[0], buffer->instrs[next].arg[0]);
+        labelNum++;
+    }
+    qsort(labels, labelNum, sizeof(AssemInstr), compareLabel);
+
+    int fired = 0;
+    for (int i = 0; i < buffer->num; i++)
+    {
+        pAssemInstr instr = &buffer->instrs[i];
+        if (instr->deleted || instr->kind != ASSEM_INSTR || (strcmp(instr->op, "j") && !isBranch(instr)))
+            continue;
+        AssemInstr key;
+        key.text = instr->arg[instr->argNum - 1];
+        pAssemInstr label = (pAssemInstr)bsearch(&key, labels, labelNum, sizeof(AssemInstr), compareLabel);
+        if (label != nullptr && label->arg[0][0] != '\0' && strcmp(label->arg[0], key.text))
+        {
+            strcpy(key.text, label->arg[0]);
+            fired++;
+        }
+    }
+    free(labels);
+    return fired;
+}
+
+int invertBranchOverJump(pAssemBuffer buffer)
+{
+    // b<op> x, y, L1; j L2; L1:  =>  b<!op> x, y, L2; L1:
+    const char *from[] = {"beq", "bne", "blt", "bge", "bgt", "ble"};
+    const char *to[] = {"bne", "beq", "bge", "blt", "ble", "bgt"};
+    int fired = 0;
+    for (int i = 0; i < buffer->num; i++)
+    {
+        pAssemInstr branch = &buffer->instrs[i];
+        if (branch->deleted || branch->kind != ASSEM_INSTR || !isBranch(branch) || branch->argNum != 3)
+            continue;
+        int j = nextInstr(buffer, i);
+        if (j < 0 || buffer->instrs[j].kind != ASSEM_INSTR || strcmp(buffer->instrs[j].op, "j") ||
+            !isLabelAhead(buffer, j, branch->arg[2]))
+            continue;
+        for (int k = 0; k < 6; k++)
+        {
+            if (!strcmp(branch->op, from[k]))
+            {
+                strcpy(branch->op, to[k]);
+                strcpy(branch->arg[2], buffer->instrs[j].arg[0]);
+                buffer->instrs[j].deleted = true;
+                fired++;
+                break;
+            }
+        }
+    }
+    return fired;
+}
+
+int removeRedundantLi(pAssemBuffer buffer)
+{
+    // li r, c where r already holds c in the same block  =>
+    boolean isKnown[REG_NUM];
+    int value[REG_NUM];
+    for (int r = 0; r < REG_NUM; r++)
+        isKnown[r] = false;
+    int fired = 0;
+    for (int i = 0; i < buffer->num; i++)
+    {
+        pAssemInstr instr = &buffer->instrs[i];
+        if (instr->deleted || instr->kind == ASSEM_TEXT)
+            continue;
+        if (instr->kind == ASSEM_LABEL || !strcmp(instr->op, "jal") || !strcmp(instr->op, "syscall"))
+        {
+            // Another block may jump here, or the callee changes registers.
+            for (int r = 0; r < REG_NUM; r++)
+                isKnown[r] = false;
+            continue;
+        }
+        int dest = getDestReg(instr);
+        if (dest < 0)
+            continue;
+        if (!strcmp(instr->op, "li"))
+        {
+            int c = atoi(instr->arg[1]);
+            if (isKnown[dest] && value[dest] == c)
+            {
+                instr->deleted = true;
+                fired++;
+                continue;
+            }
+            isKnown[dest] = true;
+            value[dest] = c;
+        }
+        else if (!strcmp(instr->op, "move") && getAssemRegNo(instr->arg[1]) >= 0 &&
+                 isKnown[getAssemRegNo(instr->arg[1])])
+        {
+            isKnown[dest] = true;
+            value[dest] = value[getAssemRegNo(instr->arg[1])];
+        }
+        else
+            isKnown[dest] = false;
+    }
+    return fired;
+}
+
+int nextInstr(pAssemBuffer buffer, int i)
+{
+    // The next label or instruction after i, comments are skipped.
+    for (int k = i + 1; k < buffer->num; k++)
+    {
+        if (!buffer->instrs[k].deleted && buffer->instrs[k].kind != ASSEM_TEXT)
+            return k;
+    }
+    return -1;
+}
+
+boolean isBranch(pAssemInstr instr)
+{
+    return instr->kind == ASSEM_INSTR && instr->op[0] == 'b';
+}
+
+int getDestReg(pAssemInstr instr)
+{
+    // The register written by instr, -1 if there is none.
+    const char *noDest[] = {"sw", "sb", "sh", "j", "jr", "jal", "syscall", "div", "divu", "mult", "multu", "nop"};
+    if (instr->argNum == 0 || isBranch(instr))
+        return -1;
+    for (int k = 0; k < (int)(sizeof(noDest) / sizeof(noDest[0])); k++)
+    {
+        if (!strcmp(instr->op, noDest[k]))
+            return -1;
+    }
+    return getAssemRegNo(instr->arg[0]);
+}
+
+int getAssemRegNo(const char *name)
+{
+    for (int r = 0; r < REG_NUM; r++)
+    {
+        if (!strcmp(REG_NAME[r], name))
+            return r;
+    }
+    return -1;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "node.h"
+#include "writer.h"
+
+// Longest operand kept in parsed form, longer lines are kept as text and never rewritten.
+#define ASSEM_ARG_LEN 48
+
+typedef struct _assemInstr* pAssemInstr;
+typedef struct _assemBuffer* pAssemBuffer;
+typedef struct _peepholeRule* pPeepholeRule;
+
+typedef struct _assemInstr {
+    enum {
+        ASSEM_INSTR, // op arg0, arg1, arg2
+        ASSEM_LABEL, // text:
+        ASSEM_TEXT, // directives, comments and blank lines, printed as they are
+    } kind;
+    char op[8];
+    char arg[3][ASSEM_ARG_LEN];
+    int argNum;
+    char* text;
+    boolean deleted;
+} AssemInstr;
+
+typedef struct _assemBuffer {
+    pAssemInstr instrs;
+    int num, capacity;
+} AssemBuffer;
+
+// A rule rewrites the whole buffer once and returns how many times it fired.
+typedef struct _peepholeRule {
+    const char* name;
+    int (*apply)(pAssemBuffer buffer);
+    int fired;
+} PeepholeRule;
+
+// The backend emits into assemBuffer, one function at a time. Each thread has its own,
+// and its own counts in peepholeRules.
+extern __thread pAssemBuffer assemBuffer;
+extern __thread PeepholeRule peepholeRules[];
+
+pAssemBuffer newAssemBuffer();
+void deleteAssemBuffer(pAssemBuffer buffer);
+void clearAssemBuffer(pAssemBuffer buffer);
+void emitCode(const char* format, ...);
+void addAssemLine(pAssemBuffer buffer, const char* line);
+void printAssemBuffer(pWriter writer, pAssemBuffer buffer);
+
+void runPeephole(pAssemBuffer buffer);
+void printPeepholeStats(FILE* fp);
+
+// Rules
+int removeSelfMoves(pAssemBuffer buffer);
+int forwardStores(pAssemBuffer buffer);
+int removeJumpsToNext(pAssemBuffer buffer);
+int threadJumps(pAssemBuffer buffer);
+int invertBranchOverJump(pAssemBuffer buffer);
+int removeRedundantLi(pAssemBuffer buffer);
+
+// Helpers
+int nextInstr(pAssemBuffer buffer, int i);
+boolean isBranch(pAssemInstr instr);
+int getDestReg(pAssemInstr instr);
+int getAssemRegNo(const char* name);
+
+#endif
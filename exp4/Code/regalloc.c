@@ -0,0 +1,1086 @@
+#include "regalloc.h"
+#include "optimize.h"
+
+const int ALLOC_REGS[ALLOC_REG_NUM] = {
+    T0, T1, T2, T3, T4, T5,
+    S0, S1, S2, S3, S4, S5, S6, S7};
+
+void allocateRegisters(pInterCodes func, pVarTable varTable)
+{
+    assert(func != nullptr && func->code->kind == IR_FUNCTION);
+    pFuncInfo info = newFuncInfo(func);
+    buildBlocks(info);
+    computeLiveness(info);
+    findCallCrossings(info);
+    findAddressFolds(info, varTable);
+    if (optLevel >= 2 && info->varNum <= COLOR_VAR_LIMIT)
+    {
+        pInterGraph graph = newInterGraph(info);
+        computeSpillCost(info, graph);
+        // Rebuild the graph after each round, so that coloring sees exact degrees.
+        do
+        {
+            buildInterGraph(info, graph);
+        } while (coalesceCopies(info, graph));
+        colorGraph(info, graph);
+        deleteInterGraph(info, graph);
+    }
+    else
+    {
+        buildIntervals(info);
+        linearScan(info);
+    }
+    for (int i = 0; i < info->varNum; i++)
+    {
+        if (info->intervals[i].reg >= 0)
+            addVariable(varTable->varListAlloc, info->intervals[i].reg, info->intervals[i].op);
+    }
+    free(varTable->callSaveMask);
+    varTable->callSaveMask = (unsigned *)calloc(info->callNum + 1, sizeof(unsigned));
+    assert(varTable->callSaveMask != nullptr);
+    for (int c = 0; c < info->callNum; c++)
+    {
+        for (int no = 0; no < info->varNum; no++)
+        {
+            int reg = info->intervals[no].reg;
+            if (reg >= 0 && (reg < S0 || reg > S7) && info->callLive[c][no / 32] & (1u << (no % 32)))
+                varTable->callSaveMask[c] |= 1u << reg;
+        }
+    }
+    hoistConstants(info, varTable);
+    colorStackSlots(info, varTable);
+    deleteFuncInfo(info);
+}
+
+pFuncInfo newFuncInfo(pInterCodes func)
+{
+    pFuncInfo info = (pFuncInfo)malloc(sizeof(FuncInfo));
+    assert(info != nullptr);
+    info->codeNum = 0;
+    pInterCodes p = func;
+    do
+    {
+        info->codeNum++;
+        p = p->next;
+    } while (p != nullptr && p->code->kind != IR_FUNCTION);
+    info->codes = (pInterCodes *)malloc(info->codeNum * sizeof(pInterCodes));
+    assert(info->codes != nullptr);
+    p = func;
+    for (int i = 0; i < info->codeNum; i++, p = p->next)
+        info->codes[i] = p;
+
+    info->varIndex = newAssemVarList();
+    info->varNum = 0;
+    info->varCapacity = 0x40;
+    info->intervals = (pInterval)malloc(info->varCapacity * sizeof(Interval));
+    assert(info->intervals != nullptr);
+    // Arrays and structures stay in memory, their slot holds the base address.
+    for (int i = 0; i < info->codeNum; i++)
+    {
+        pInterCode code = info->codes[i]->code;
+        int no = -1;
+        if (code->kind == IR_DEC)
+            no = getVarNo(info, code->u.dec.op);
+        else if (code->kind == IR_GET_ADDR)
+            no = getVarNo(info, code->u.assign.right);
+        if (no >= 0)
+            info->intervals[no].inMemory = true;
+    }
+    // Number all the other variables, so that bit sets have a fixed size.
+    pOperand def = nullptr, uses[3];
+    for (int i = 0; i < info->codeNum; i++)
+    {
+        int useNum = getDefUse(info->codes[i]->code, &def, uses);
+        getVarNo(info, def);
+        for (int k = 0; k < useNum; k++)
+            getVarNo(info, uses[k]);
+    }
+    info->blocks = nullptr;
+    info->blockNum = 0;
+    info->blockOf = nullptr;
+    info->setWords = 0;
+    info->callNum = 0;
+    info->callLive = nullptr;
+    return info;
+}
+
+void deleteFuncInfo(pFuncInfo info)
+{
+    assert(info != nullptr);
+    for (int i = 0; i < info->blockNum; i++)
+    {
+        free(info->blocks[i].use);
+        free(info->blocks[i].def);
+        free(info->blocks[i].liveIn);
+        free(info->blocks[i].liveOut);
+    }
+    for (int c = 0; c < info->callNum; c++)
+        free(info->callLive[c]);
+    free(info->callLive);
+    free(info->blocks);
+    free(info->blockOf);
+    free(info->intervals);
+    clearAssemVarList(info->varIndex);
+    free(info->varIndex);
+    free(info->codes);
+    free(info);
+}
+
+int getVarNo(pFuncInfo info, pOperand op)
+{
+    // Index of the variable named by op, a new one is added for an unseen name.
+    if (op == nullptr || (op->kind != OP_VARIABLE && op->kind != OP_ADDRESS))
+        return -1;
+    pVariable var = searchVariable(info->varIndex, op);
+    if (var != nullptr)
+        return var->index;
+    if (info->varNum == info->varCapacity)
+    {
+        info->varCapacity *= 2;
+        info->intervals = (pInterval)realloc(info->intervals, info->varCapacity * sizeof(Interval));
+        assert(info->intervals != nullptr);
+    }
+    pInterval interval = &info->intervals[info->varNum];
+    interval->op = op;
+    interval->start = info->codeNum;
+    interval->end = -1;
+    interval->reg = -1;
+    interval->inMemory = false;
+    interval->crossesCall = false;
+    addVariable(info->varIndex, info->varNum, op);
+    return info->varNum++;
+}
+
+int getDefUse(pInterCode code, pOperand *def, pOperand uses[])
+{
+    // The operand defined by code and the operands read by it, returns the number of uses.
+    int useNum = 0;
+    *def = nullptr;
+    switch (code->kind)
+    {
+    case IR_PARAM:
+    case IR_READ:
+        *def = code->u.oneOp.op;
+        break;
+    case IR_ARG:
+    case IR_ARG_ADDR:
+    case IR_RETURN:
+    case IR_WRITE:
+        uses[useNum++] = code->u.oneOp.op;
+        break;
+    case IR_ASSIGN:
+    case IR_READ_ADDR:
+        *def = code->u.assign.left;
+        uses[useNum++] = code->u.assign.right;
+        break;
+    case IR_CALL:
+    case IR_GET_ADDR:
+        *def = code->u.assign.left;
+        break;
+    case IR_WRITE_ADDR:
+        uses[useNum++] = code->u.assign.left;
+        uses[useNum++] = code->u.assign.right;
+        break;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_ADD_ADDR:
+        *def = code->u.binOp.result;
+        uses[useNum++] = code->u.binOp.op1;
+        uses[useNum++] = code->u.binOp.op2;
+        break;
+    case IR_IF_GOTO:
+        uses[useNum++] = code->u.ifGoto.x;
+        uses[useNum++] = code->u.ifGoto.y;
+        break;
+    case IR_COPY:
+        uses[useNum++] = code->u.copy.dst;
+        uses[useNum++] = code->u.copy.src;
+        break;
+    default: // IR_LABEL, IR_FUNCTION, IR_GOTO, IR_DEC
+        break;
+    }
+    return useNum;
+}
+
+void buildBlocks(pFuncInfo info)
+{
+    // A block begins at the function, at a label, or after a jump.
+    info->blockOf = (int *)malloc(info->codeNum * sizeof(int));
+    assert(info->blockOf != nullptr);
+    int blockNum = 0;
+    for (int i = 0; i < info->codeNum; i++)
+    {
+        int kind = info->codes[i]->code->kind;
+        int prevKind = i > 0 ? (int)info->codes[i - 1]->code->kind : -1;
+        if (i == 0 || kind == IR_LABEL ||
+            prevKind == IR_GOTO || prevKind == IR_IF_GOTO || prevKind == IR_RETURN)
+            blockNum++;
+        info->blockOf[i] = blockNum - 1;
+    }
+    info->blockNum = blockNum;
+    info->setWords = (info->varNum + 31) / 32;
+    info->blocks = (pBasicBlock)malloc(blockNum * sizeof(BasicBlock));
+    assert(info->blocks != nullptr);
+
+    int *labelBlock = (int *)malloc((interCodeList->labelNum + 1) * sizeof(int));
+    assert(labelBlock != nullptr);
+    for (int i = 0; i < info->codeNum; i++)
+    {
+        pBasicBlock block = &info->blocks[info->blockOf[i]];
+        if (i == 0 || info->blockOf[i - 1] != info->blockOf[i])
+            block->first = i;
+        block->last = i;
+        if (info->codes[i]->code->kind == IR_LABEL)
+            labelBlock[getLabelNo(info->codes[i]->code->u.oneOp.op)] = info->blockOf[i];
+    }
+    for (int b = 0; b < blockNum; b++)
+    {
+        pBasicBlock block = &info->blocks[b];
+        pInterCode last = info->codes[block->last]->code;
+        block->succNum = 0;
+        if (last->kind == IR_GOTO)
+            block->succ[block->succNum++] = labelBlock[getLabelNo(last->u.oneOp.op)];
+        else if (last->kind != IR_RETURN && b + 1 < blockNum)
+            block->succ[block->succNum++] = b + 1;
+        if (last->kind == IR_IF_GOTO)
+            block->succ[block->succNum++] = labelBlock[getLabelNo(last->u.ifGoto.z)];
+        block->use = (unsigned *)calloc(info->setWords + 1, sizeof(unsigned));
+        block->def = (unsigned *)calloc(info->setWords + 1, sizeof(unsigned));
+        block->liveIn = (unsigned *)calloc(info->setWords + 1, sizeof(unsigned));
+        block->liveOut = (unsigned *)calloc(info->setWords + 1, sizeof(unsigned));
+        assert(block->use && block->def && block->liveIn && block->liveOut);
+    }
+    free(labelBlock);
+}
+
+void computeLiveness(pFuncInfo info)
+{
+    pOperand def = nullptr, uses[3];
+    for (int b = 0; b < info->blockNum; b++)
+    {
+        pBasicBlock block = &info->blocks[b];
+        for (int i = block->first; i <= block->last; i++)
+        {
+            int useNum = getDefUse(info->codes[i]->code, &def, uses);
+            for (int k = 0; k < useNum; k++)
+            {
+                int no = getVarNo(info, uses[k]);
+                if (no >= 0 && !(block->def[no / 32] & (1u << (no % 32))))
+                    block->use[no / 32] |= 1u << (no % 32);
+            }
+            int no = getVarNo(info, def);
+            if (no >= 0)
+                block->def[no / 32] |= 1u << (no % 32);
+        }
+    }
+    // liveOut = U liveIn(succ), liveIn = use U (liveOut - def), until nothing changes.
+    boolean changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int b = info->blockNum - 1; b >= 0; b--)
+        {
+            pBasicBlock block = &info->blocks[b];
+            for (int w = 0; w < info->setWords; w++)
+            {
+                unsigned out = 0;
+                for (int s = 0; s < block->succNum; s++)
+                    out |= info->blocks[block->succ[s]].liveIn[w];
+                unsigned in = block->use[w] | (out & ~block->def[w]);
+                if (out != block->liveOut[w] || in != block->liveIn[w])
+                {
+                    block->liveOut[w] = out;
+                    block->liveIn[w] = in;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+void findCallCrossings(pFuncInfo info)
+{
+    // Variables live after a call other than its result, walking each block backwards.
+    for (int i = 0; i < info->codeNum; i++)
+    {
+        if (info->codes[i]->code->kind == IR_CALL)
+            info->callNum++;
+    }
+    info->callLive = (unsigned **)malloc((info->callNum + 1) * sizeof(unsigned *));
+    assert(info->callLive != nullptr);
+    unsigned *live = (unsigned *)calloc(info->setWords + 1, sizeof(unsigned));
+    assert(live != nullptr);
+    pOperand def = nullptr, uses[3];
+    int c = info->callNum;
+    for (int b = info->blockNum - 1; b >= 0; b--)
+    {
+        pBasicBlock block = &info->blocks[b];
+        memcpy(live, block->liveOut, (info->setWords + 1) * sizeof(unsigned));
+        for (int i = block->last; i >= block->first; i--)
+        {
+            int useNum = getDefUse(info->codes[i]->code, &def, uses);
+            int no = getVarNo(info, def);
+            if (no >= 0)
+                live[no / 32] &= ~(1u << (no % 32));
+            if (info->codes[i]->code->kind == IR_CALL)
+            {
+                c--;
+                info->callLive[c] = (unsigned *)malloc((info->setWords + 1) * sizeof(unsigned));
+                assert(info->callLive[c] != nullptr);
+                memcpy(info->callLive[c], live, (info->setWords + 1) * sizeof(unsigned));
+                for (int v = 0; v < info->varNum; v++)
+                {
+                    if (live[v / 32] & (1u << (v % 32)))
+                        info->intervals[v].crossesCall = true;
+                }
+            }
+            for (int k = 0; k < useNum; k++)
+            {
+                no = getVarNo(info, uses[k]);
+                if (no >= 0)
+                    live[no / 32] |= 1u << (no % 32);
+            }
+        }
+    }
+    assert(c == 0);
+    free(live);
+}
+
+static boolean isSameName(pOperand x, pOperand y)
+{
+    return x != nullptr && y != nullptr && x->kind != OP_CONSTANT && y->kind != OP_CONSTANT &&
+           !strcmp(x->u.name, y->u.name);
+}
+
+static boolean isLocalArray(pFuncInfo info, pOperand op)
+{
+    for (int i = 0; i < info->codeNum; i++)
+    {
+        pInterCode code = info->codes[i]->code;
+        if (code->kind == IR_DEC && isSameName(code->u.dec.op, op))
+            return true;
+    }
+    return false;
+}
+
+void findAddressFolds(pFuncInfo info, pVarTable varTable)
+{
+    /*
+    t := &a and t := x + #c need no instruction when the next code is the only one that uses t,
+    and it is a load or store through t, or another such addition to t. The address then goes
+    into the offset of the load or store: lw y, c(x), or c($sp) for a local array.
+    t := &a followed by u := t + x is folded too when u only feeds such a load or store,
+    u gets $sp + x and the base of a goes into the offset.
+    */
+    free(varTable->isFoldedAddr);
+    varTable->isFoldedAddr = (boolean *)calloc(info->codeNum + 1, sizeof(boolean));
+    boolean *feedsMem = (boolean *)calloc(info->codeNum + 1, sizeof(boolean));
+    assert(varTable->isFoldedAddr != nullptr && feedsMem != nullptr);
+    boolean *isFolded = varTable->isFoldedAddr;
+    unsigned *live = (unsigned *)malloc(sizeof(unsigned) * (info->setWords + 1));
+    assert(live != nullptr);
+    pOperand def = nullptr, uses[3];
+    for (int b = 0; b < info->blockNum; b++)
+    {
+        pBasicBlock block = &info->blocks[b];
+        memcpy(live, block->liveOut, sizeof(unsigned) * info->setWords);
+        // live holds the variables live after code j.
+        for (int j = block->last; j >= block->first; j--)
+        {
+            pInterCode next = info->codes[j]->code;
+            pInterCode code = j > block->first ? info->codes[j - 1]->code : nullptr;
+            pOperand result = nullptr;
+            if (code != nullptr && code->kind == IR_GET_ADDR && isLocalArray(info, code->u.assign.right))
+                result = code->u.assign.left;
+            else if (code != nullptr && code->kind == IR_ADD_ADDR &&
+                     (code->u.binOp.op1->kind != OP_CONSTANT || code->u.binOp.op2->kind != OP_CONSTANT))
+                result = code->u.binOp.result;
+            int no = getVarNo(info, result);
+            if (no >= 0)
+            {
+                getDefUse(next, &def, uses);
+                boolean isDead = !(live[no / 32] & (1u << (no % 32))) || isSameName(def, result);
+                boolean isOnlyUse = false;
+                if (next->kind == IR_READ_ADDR)
+                    isOnlyUse = isSameName(next->u.assign.right, result);
+                else if (next->kind == IR_WRITE_ADDR)
+                    isOnlyUse = isSameName(next->u.assign.left, result) && !isSameName(next->u.assign.right, result);
+                else if (next->kind == IR_ADD_ADDR && isFolded[j])
+                    isOnlyUse = isSameName(next->u.binOp.op1, result) || isSameName(next->u.binOp.op2, result);
+                if (code->kind == IR_ADD_ADDR && code->u.binOp.op1->kind != OP_CONSTANT &&
+                    code->u.binOp.op2->kind != OP_CONSTANT)
+                    feedsMem[j - 1] = isDead && isOnlyUse;
+                else
+                    isFolded[j - 1] = isDead && isOnlyUse;
+                if (code->kind == IR_GET_ADDR && isDead && next->kind == IR_ADD_ADDR && feedsMem[j] &&
+                    isSameName(next->u.binOp.op1, result) != isSameName(next->u.binOp.op2, result))
+                {
+                    isFolded[j - 1] = true;
+                    isFolded[j] = true;
+                }
+            }
+            int useNum = getDefUse(next, &def, uses);
+            no = getVarNo(info, def);
+            if (no >= 0)
+                live[no / 32] &= ~(1u << (no % 32));
+            for (int k = 0; k < useNum; k++)
+            {
+                no = getVarNo(info, uses[k]);
+                if (no >= 0)
+                    live[no / 32] |= 1u << (no % 32);
+            }
+        }
+    }
+    free(live);
+    free(feedsMem);
+}
+
+int pickRegister(const boolean *isFree, boolean crossesCall)
+{
+    // A variable live across a call tries $s registers first, the others try $t registers first.
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int r = 0; r < ALLOC_REG_NUM; r++)
+        {
+            int reg = ALLOC_REGS[r];
+            boolean isSaved = reg >= S0 && reg <= S7;
+            if (isFree[reg] && (pass == 1 || isSaved == crossesCall))
+                return reg;
+        }
+    }
+    return -1;
+}
+
+void buildIntervals(pFuncInfo info)
+{
+    // One interval per variable, from the first to the last position where it is live.
+    pOperand def = nullptr, uses[3];
+    int callPos = -1;
+    for (int i = info->codeNum - 1; i >= 0; i--)
+    {
+        pInterCode code = info->codes[i]->code;
+        if (code->kind == IR_CALL)
+            callPos = i;
+        int useNum = getDefUse(code, &def, uses);
+        // The backend reads arguments at the call.
+        int usePos = (code->kind == IR_ARG || code->kind == IR_ARG_ADDR) ? callPos : i;
+        assert(usePos >= 0);
+        for (int k = 0; k < useNum; k++)
+        {
+            int no = getVarNo(info, uses[k]);
+            if (no < 0)
+                continue;
+            if (info->intervals[no].start > i)
+                info->intervals[no].start = i;
+            if (info->intervals[no].end < usePos)
+                info->intervals[no].end = usePos;
+        }
+        int no = getVarNo(info, def);
+        if (no >= 0)
+        {
+            if (info->intervals[no].start > i)
+                info->intervals[no].start = i;
+            if (info->intervals[no].end < i)
+                info->intervals[no].end = i;
+        }
+    }
+    for (int b = 0; b < info->blockNum; b++)
+    {
+        pBasicBlock block = &info->blocks[b];
+        for (int no = 0; no < info->varNum; no++)
+        {
+            if (block->liveIn[no / 32] & (1u << (no % 32)) && info->intervals[no].start > block->first)
+                info->intervals[no].start = block->first;
+            if (block->liveOut[no / 32] & (1u << (no % 32)) && info->intervals[no].end < block->last)
+                info->intervals[no].end = block->last;
+        }
+    }
+}
+
+static int compareStart(const void *a, const void *b)
+{
+    pInterval x = *(pInterval *)a, y = *(pInterval *)b;
+    return x->start != y->start ? x->start - y->start : x->end - y->end;
+}
+
+void linearScan(pFuncInfo info)
+{
+    pInterval *sorted = (pInterval *)malloc((info->varNum + 1) * sizeof(pInterval));
+    assert(sorted != nullptr);
+    int num = 0;
+    for (int i = 0; i < info->varNum; i++)
+    {
+        if (!info->intervals[i].inMemory && info->intervals[i].end >= 0)
+            sorted[num++] = &info->intervals[i];
+    }
+    qsort(sorted, num, sizeof(pInterval), compareStart);
+
+    // active is sorted by increasing end.
+    pInterval active[ALLOC_REG_NUM];
+    int activeNum = 0;
+    boolean isFree[REG_NUM];
+    for (int r = 0; r < REG_NUM; r++)
+        isFree[r] = false;
+    for (int r = 0; r < ALLOC_REG_NUM; r++)
+        isFree[ALLOC_REGS[r]] = true;
+
+    for (int i = 0; i < num; i++)
+    {
+        pInterval cur = sorted[i];
+        // Expire intervals ended before cur starts.
+        int expired = 0;
+        while (expired < activeNum && active[expired]->end < cur->start)
+        {
+            isFree[active[expired]->reg] = true;
+            expired++;
+        }
+        for (int k = expired; k < activeNum; k++)
+            active[k - expired] = active[k];
+        activeNum -= expired;
+
+        if (activeNum == ALLOC_REG_NUM)
+        {
+            // Spill the interval that ends last.
+            pInterval spill = active[activeNum - 1];
+            if (spill->end <= cur->end)
+            {
+                cur->reg = -1;
+                continue;
+            }
+            cur->reg = spill->reg;
+            spill->reg = -1;
+            activeNum--;
+        }
+        else
+        {
+            cur->reg = pickRegister(isFree, cur->crossesCall);
+            assert(cur->reg >= 0);
+            isFree[cur->reg] = false;
+        }
+        int k = activeNum;
+        while (k > 0 && active[k - 1]->end > cur->end)
+        {
+            active[k] = active[k - 1];
+            k--;
+        }
+        active[k] = cur;
+        activeNum++;
+    }
+    free(sorted);
+}
+
+pInterGraph newInterGraph(pFuncInfo info)
+{
+    pInterGraph graph = (pInterGraph)malloc(sizeof(InterGraph));
+    assert(graph != nullptr);
+    int n = info->varNum;
+    graph->matrix = (unsigned *)calloc(((size_t)n * n + 31) / 32 + 1, sizeof(unsigned));
+    graph->adj = (int **)malloc((n + 1) * sizeof(int *));
+    graph->adjNum = (int *)calloc(n + 1, sizeof(int));
+    graph->adjCapacity = (int *)calloc(n + 1, sizeof(int));
+    graph->alias = (int *)malloc((n + 1) * sizeof(int));
+    graph->cost = (double *)calloc(n + 1, sizeof(double));
+    assert(graph->matrix && graph->adj && graph->adjNum && graph->adjCapacity && graph->alias && graph->cost);
+    for (int i = 0; i < n; i++)
+    {
+        graph->adj[i] = nullptr;
+        graph->alias[i] = i;
+    }
+    return graph;
+}
+
+void deleteInterGraph(pFuncInfo info, pInterGraph graph)
+{
+    assert(graph != nullptr);
+    for (int i = 0; i < info->varNum; i++)
+        free(graph->adj[i]);
+    free(graph->adj);
+    free(graph->adjNum);
+    free(graph->adjCapacity);
+    free(graph->alias);
+    free(graph->cost);
+    free(graph->matrix);
+    free(graph);
+}
+
+int getAlias(pInterGraph graph, int no)
+{
+    while (graph->alias[no] != no)
+    {
+        graph->alias[no] = graph->alias[graph->alias[no]];
+        no = graph->alias[no];
+    }
+    return no;
+}
+
+boolean isInterfering(pFuncInfo info, pInterGraph graph, int x, int y)
+{
+    size_t bit = (size_t)x * info->varNum + y;
+    return (graph->matrix[bit / 32] & (1u << (bit % 32))) != 0;
+}
+
+static void addAdjacent(pInterGraph graph, int x, int y)
+{
+    if (graph->adjNum[x] == graph->adjCapacity[x])
+    {
+        graph->adjCapacity[x] = graph->adjCapacity[x] ? graph->adjCapacity[x] * 2 : 8;
+        graph->adj[x] = (int *)realloc(graph->adj[x], graph->adjCapacity[x] * sizeof(int));
+        assert(graph->adj[x] != nullptr);
+    }
+    graph->adj[x][graph->adjNum[x]++] = y;
+}
+
+void addInterference(pFuncInfo info, pInterGraph graph, int x, int y)
+{
+    x = getAlias(graph, x);
+    y = getAlias(graph, y);
+    if (x == y || info->intervals[x].inMemory || info->intervals[y].inMemory ||
+        isInterfering(info, graph, x, y))
+        return;
+    size_t bit = (size_t)x * info->varNum + y;
+    graph->matrix[bit / 32] |= 1u << (bit % 32);
+    bit = (size_t)y * info->varNum + x;
+    graph->matrix[bit / 32] |= 1u << (bit % 32);
+    addAdjacent(graph, x, y);
+    addAdjacent(graph, y, x);
+}
+
+void buildInterGraph(pFuncInfo info, pInterGraph graph)
+{
+    // A definition interferes with everything live after it.
+    int n = info->varNum;
+    memset(graph->matrix, 0, (((size_t)n * n + 31) / 32 + 1) * sizeof(unsigned));
+    for (int i = 0; i < n; i++)
+        graph->adjNum[i] = 0;
+    unsigned *live = (unsigned *)calloc(info->setWords + 1, sizeof(unsigned));
+    assert(live != nullptr);
+    pOperand def = nullptr, uses[3];
+    for (int b = 0; b < info->blockNum; b++)
+    {
+        pBasicBlock block = &info->blocks[b];
+        memcpy(live, block->liveOut, (info->setWords + 1) * sizeof(unsigned));
+        for (int i = block->last; i >= block->first; i--)
+        {
+            pInterCode code = info->codes[i]->code;
+            int useNum = getDefUse(code, &def, uses);
+            int d = getVarNo(info, def);
+            if (d >= 0)
+            {
+                // x := y does not make x and y interfere, they hold the same value.
+                int except = code->kind == IR_ASSIGN ? getVarNo(info, code->u.assign.right) : -1;
+                for (int w = 0; w < info->setWords; w++)
+                {
+                    for (unsigned bits = live[w]; bits != 0; bits &= bits - 1)
+                    {
+                        int l = w * 32 + __builtin_ctz(bits);
+                        if (l != except)
+                            addInterference(info, graph, d, l);
+                    }
+                }
+                live[d / 32] &= ~(1u << (d % 32));
+            }
+            if (code->kind == IR_CALL)
+            {
+                // The backend reads arguments at the call.
+                for (int k = i - 1; k >= block->first; k--)
+                {
+                    pInterCode arg = info->codes[k]->code;
+                    if (arg->kind != IR_ARG && arg->kind != IR_ARG_ADDR)
+                        break;
+                    int no = getVarNo(info, arg->u.oneOp.op);
+                    if (no >= 0)
+                        live[no / 32] |= 1u << (no % 32);
+                }
+            }
+            for (int k = 0; k < useNum; k++)
+            {
+                int no = getVarNo(info, uses[k]);
+                if (no >= 0)
+                    live[no / 32] |= 1u << (no % 32);
+            }
+        }
+    }
+    free(live);
+}
+
+int *computeLoopDepth(pFuncInfo info)
+{
+    /*
+    The inter code keeps loops in layout order, so a jump back from block b to block h
+    makes blocks h..b a loop.
+    */
+    int *depth = (int *)calloc(info->blockNum + 1, sizeof(int));
+    assert(depth != nullptr);
+    for (int b = 0; b < info->blockNum; b++)
+    {
+        for (int s = 0; s < info->blocks[b].succNum; s++)
+        {
+            int h = info->blocks[b].succ[s];
+            for (int k = h; h <= b && k <= b; k++)
+                depth[k]++;
+        }
+    }
+    return depth;
+}
+
+void computeSpillCost(pFuncInfo info, pInterGraph graph)
+{
+    // Every use and definition costs 10^depth, where depth is the loop depth of its block.
+    int *depth = computeLoopDepth(info);
+    pOperand def = nullptr, uses[3];
+    for (int i = 0; i < info->codeNum; i++)
+    {
+        double weight = 1;
+        for (int k = 0; k < depth[info->blockOf[i]] && k < 8; k++)
+            weight *= 10;
+        int useNum = getDefUse(info->codes[i]->code, &def, uses);
+        int no = getVarNo(info, def);
+        if (no >= 0)
+            graph->cost[no] += weight;
+        for (int k = 0; k < useNum; k++)
+        {
+            no = getVarNo(info, uses[k]);
+            if (no >= 0)
+                graph->cost[no] += weight;
+        }
+    }
+    free(depth);
+}
+
+boolean coalesceCopies(pFuncInfo info, pInterGraph graph)
+{
+    /*
+    Merge x and y of x := y when they do not interfere, and the merged node has
+    fewer than ALLOC_REG_NUM neighbours of significant degree (Briggs), so that
+    coalescing never turns a colorable graph into an uncolorable one.
+    */
+    boolean merged = false;
+    int *mark = (int *)calloc(info->varNum + 1, sizeof(int));
+    assert(mark != nullptr);
+    int stamp = 0;
+    for (int i = 0; i < info->codeNum; i++)
+    {
+        pInterCode code = info->codes[i]->code;
+        if (code->kind != IR_ASSIGN || code->u.assign.right->kind != OP_VARIABLE)
+            continue;
+        int x = getAlias(graph, getVarNo(info, code->u.assign.left));
+        int y = getAlias(graph, getVarNo(info, code->u.assign.right));
+        if (x == y || info->intervals[x].inMemory || info->intervals[y].inMemory ||
+            isInterfering(info, graph, x, y))
+            continue;
+        int significant = 0;
+        stamp++;
+        for (int k = 0; k < 2; k++)
+        {
+            int node = k == 0 ? x : y;
+            for (int j = 0; j < graph->adjNum[node]; j++)
+            {
+                int m = getAlias(graph, graph->adj[node][j]);
+                if (mark[m] == stamp)
+                    continue;
+                mark[m] = stamp;
+                if (graph->adjNum[m] >= ALLOC_REG_NUM)
+                    significant++;
+            }
+        }
+        if (significant >= ALLOC_REG_NUM)
+            continue;
+        graph->alias[y] = x;
+        for (int j = 0; j < graph->adjNum[y]; j++)
+            addInterference(info, graph, x, graph->adj[y][j]);
+        merged = true;
+    }
+    free(mark);
+    return merged;
+}
+
+void colorGraph(pFuncInfo info, pInterGraph graph)
+{
+    int n = info->varNum;
+    int *degree = (int *)malloc((n + 1) * sizeof(int));
+    int *color = (int *)malloc((n + 1) * sizeof(int));
+    int *stack = (int *)malloc((n + 1) * sizeof(int));
+    int *worklist = (int *)malloc((n + 1) * sizeof(int));
+    boolean *removed = (boolean *)malloc((n + 1) * sizeof(boolean));
+    double *cost = (double *)calloc(n + 1, sizeof(double));
+    assert(degree && color && stack && worklist && removed && cost);
+    int nodeNum = 0, stackNum = 0, worklistNum = 0;
+    // A coalesced node crosses a call when any of its variables does.
+    boolean *crossesCall = (boolean *)calloc(n + 1, sizeof(boolean));
+    assert(crossesCall != nullptr);
+    for (int i = 0; i < n; i++)
+    {
+        cost[getAlias(graph, i)] += graph->cost[i];
+        if (info->intervals[i].crossesCall)
+            crossesCall[getAlias(graph, i)] = true;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        color[i] = -1;
+        degree[i] = graph->adjNum[i];
+        removed[i] = getAlias(graph, i) != i || info->intervals[i].inMemory;
+        if (removed[i])
+            continue;
+        nodeNum++;
+        if (degree[i] < ALLOC_REG_NUM)
+            worklist[worklistNum++] = i;
+    }
+
+    // Simplify: remove nodes of low degree, when there is none pick the cheapest one
+    // to spill and remove it optimistically.
+    while (stackNum < nodeNum)
+    {
+        if (worklistNum == 0)
+        {
+            int spill = -1;
+            for (int i = 0; i < n; i++)
+            {
+                if (!removed[i] && (spill < 0 || cost[i] * degree[spill] < cost[spill] * degree[i]))
+                    spill = i;
+            }
+            worklist[worklistNum++] = spill;
+        }
+        int node = worklist[--worklistNum];
+        removed[node] = true;
+        stack[stackNum++] = node;
+        for (int j = 0; j < graph->adjNum[node]; j++)
+        {
+            int m = graph->adj[node][j];
+            if (!removed[m] && --degree[m] == ALLOC_REG_NUM - 1)
+                worklist[worklistNum++] = m;
+        }
+    }
+
+    // Select: color in reverse order, a node without a free color is spilled.
+    while (stackNum > 0)
+    {
+        int node = stack[--stackNum];
+        boolean isFree[REG_NUM];
+        for (int r = 0; r < REG_NUM; r++)
+            isFree[r] = true;
+        for (int j = 0; j < graph->adjNum[node]; j++)
+        {
+            int m = graph->adj[node][j];
+            if (color[m] >= 0)
+                isFree[color[m]] = false;
+        }
+        color[node] = pickRegister(isFree, crossesCall[node]);
+    }
+    for (int i = 0; i < n; i++)
+        info->intervals[i].reg = info->intervals[i].inMemory ? -1 : color[getAlias(graph, i)];
+    free(degree);
+    free(color);
+    free(stack);
+    free(worklist);
+    free(removed);
+    free(cost);
+    free(crossesCall);
+}
+
+void colorStackSlots(pFuncInfo info, pVarTable varTable)
+{
+    /*
+    Spilled variables live at the same position interfere, the others may share a slot.
+    The live sets before each code stay in varTable->slotLive, the backend does not write back
+    a dead variable since its slot may hold another variable by then.
+    Parameters keep their slots in the frame of the caller.
+    */
+    clearAssemVarList(varTable->varListSlot);
+    free(varTable->slotColor);
+    free(varTable->slotLive);
+    boolean *isParam = (boolean *)calloc(info->varNum + 1, sizeof(boolean));
+    int *spilled = (int *)malloc((info->varNum + 1) * sizeof(int));
+    assert(isParam != nullptr && spilled != nullptr);
+    for (int i = 1; i < info->codeNum && info->codes[i]->code->kind == IR_PARAM; i++)
+        isParam[getVarNo(info, info->codes[i]->code->u.oneOp.op)] = true;
+    int num = 0;
+    for (int no = 0; no < info->varNum; no++)
+    {
+        if (info->intervals[no].reg >= 0 || info->intervals[no].inMemory || isParam[no])
+            continue;
+        addVariable(varTable->varListSlot, num, info->intervals[no].op);
+        spilled[num++] = no;
+    }
+    int words = num / 32 + 1;
+    varTable->slotWords = words;
+    varTable->slotLive = (unsigned *)calloc(info->codeNum * words, sizeof(unsigned));
+    varTable->slotColor = (int *)malloc((num + 1) * sizeof(int));
+    unsigned *live = (unsigned *)calloc(info->setWords + 1, sizeof(unsigned));
+    boolean isColored = num <= COLOR_VAR_LIMIT;
+    unsigned *matrix = isColored ? (unsigned *)calloc(num * words + 1, sizeof(unsigned)) : nullptr;
+    assert(varTable->slotLive != nullptr && varTable->slotColor != nullptr && live != nullptr);
+    assert(!isColored || matrix != nullptr);
+
+    pOperand def = nullptr, uses[3];
+    for (int b = 0; b < info->blockNum; b++)
+    {
+        pBasicBlock block = &info->blocks[b];
+        memcpy(live, block->liveOut, (info->setWords + 1) * sizeof(unsigned));
+        for (int i = block->last; i >= block->first; i--)
+        {
+            int useNum = getDefUse(info->codes[i]->code, &def, uses);
+            int no = getVarNo(info, def);
+            if (no >= 0)
+                live[no / 32] &= ~(1u << (no % 32));
+            for (int k = 0; k < useNum; k++)
+            {
+                no = getVarNo(info, uses[k]);
+                if (no >= 0)
+                    live[no / 32] |= 1u << (no % 32);
+            }
+            unsigned *slotLive = &varTable->slotLive[i * words];
+            for (int v = 0; v < num; v++)
+            {
+                if (live[spilled[v] / 32] & (1u << (spilled[v] % 32)))
+                    slotLive[v / 32] |= 1u << (v % 32);
+            }
+            for (int v = 0; isColored && v < num; v++)
+            {
+                if (!(slotLive[v / 32] & (1u << (v % 32))))
+                    continue;
+                for (int w = 0; w < words; w++)
+                    matrix[v * words + w] |= slotLive[w];
+            }
+        }
+    }
+
+    // Greedy in the order of the variables, the lowest slot no neighbour has taken.
+    boolean *isTaken = (boolean *)malloc((num + 1) * sizeof(boolean));
+    assert(isTaken != nullptr);
+    varTable->slotNum = 0;
+    for (int v = 0; v < num; v++)
+    {
+        int color = v;
+        if (isColored)
+        {
+            memset(isTaken, 0, (num + 1) * sizeof(boolean));
+            for (int u = 0; u < v; u++)
+            {
+                if (matrix[v * words + u / 32] & (1u << (u % 32)))
+                    isTaken[varTable->slotColor[u]] = true;
+            }
+            for (color = 0; isTaken[color]; color++)
+                ;
+        }
+        varTable->slotColor[v] = color;
+        varTable->slotNum = color + 1 > varTable->slotNum ? color + 1 : varTable->slotNum;
+    }
+    free(isTaken);
+    free(matrix);
+    free(live);
+    free(spilled);
+    free(isParam);
+}
+
+boolean getLoopConstant(pInterCode code, int *value)
+{
+    // The constant code loads with li, when it is no immediate of the instruction selected for code.
+    pOperand op = nullptr;
+    switch (code->kind)
+    {
+    case IR_ADD:
+    case IR_ADD_ADDR:
+    case IR_SUB:
+    case IR_MUL:
+        op = code->u.binOp.op1->kind == OP_CONSTANT ? code->u.binOp.op1 : code->u.binOp.op2;
+        if (code->kind == IR_MUL && getMulConstCost(op->u.value) <= MUL_SHIFT_MAX)
+            op = nullptr;
+        break;
+    case IR_DIV:
+        op = code->u.binOp.op2;
+        if (code->u.binOp.op1->kind != OP_CONSTANT && op->kind == OP_CONSTANT)
+        {
+            // Division by a constant loads its magic number.
+            unsigned absValue = op->u.value < 0 ? -(unsigned)op->u.value : (unsigned)op->u.value;
+            if (absValue <= 1 || getLog2(absValue) >= 0)
+                return false;
+            int shift;
+            computeMagic(op->u.value, value, &shift);
+            return true;
+        }
+        op = code->u.binOp.op1;
+        break;
+    case IR_IF_GOTO:
+        op = code->u.ifGoto.x->kind == OP_CONSTANT ? code->u.ifGoto.x : code->u.ifGoto.y;
+        break;
+    case IR_WRITE_ADDR:
+        op = code->u.assign.right;
+        break;
+    default:
+        break;
+    }
+    if (op == nullptr || op->kind != OP_CONSTANT || isImmediate(op->u.value))
+        return false;
+    *value = op->u.value;
+    return true;
+}
+
+void hoistConstants(pFuncInfo info, pVarTable varTable)
+{
+    /*
+    Large constants used in loops are loaded once in the prologue, into allocatable registers
+    no variable of the function got. The entry comes before every loop, so it serves as their
+    preheader. The most used constants, weighted by 10^depth, go first.
+    */
+    boolean isFree[REG_NUM];
+    for (int r = 0; r < REG_NUM; r++)
+        isFree[r] = false;
+    for (int r = 0; r < ALLOC_REG_NUM; r++)
+        isFree[ALLOC_REGS[r]] = true;
+    for (int i = 0; i < info->varNum; i++)
+    {
+        if (info->intervals[i].reg >= 0)
+            isFree[info->intervals[i].reg] = false;
+    }
+    int *depth = computeLoopDepth(info);
+    int *values = (int *)malloc(sizeof(int) * (info->codeNum + 1));
+    double *weights = (double *)malloc(sizeof(double) * (info->codeNum + 1));
+    assert(values != nullptr && weights != nullptr);
+    int num = 0;
+    for (int i = 0; i < info->codeNum; i++)
+    {
+        int value, d = depth[info->blockOf[i]];
+        if (d == 0 || !getLoopConstant(info->codes[i]->code, &value))
+            continue;
+        double weight = 1;
+        for (int k = 0; k < d && k < 8; k++)
+            weight *= 10;
+        int k = 0;
+        while (k < num && values[k] != value)
+            k++;
+        if (k == num)
+        {
+            values[num] = value;
+            weights[num++] = 0;
+        }
+        weights[k] += weight;
+    }
+    while (num > 0)
+    {
+        int best = 0;
+        for (int k = 1; k < num; k++)
+        {
+            if (weights[k] > weights[best])
+                best = k;
+        }
+        // Constants live across every call, a $t register is saved around each of them.
+        int reg = pickRegister(isFree, info->callNum > 0);
+        if (reg < 0)
+            break;
+        isFree[reg] = false;
+        varTable->isHoisted[reg] = true;
+        varTable->hoistedValue[reg] = values[best];
+        if (reg < S0 || reg > S7)
+        {
+            for (int c = 0; c < info->callNum; c++)
+                varTable->callSaveMask[c] |= 1u << reg;
+        }
+        values[best] = values[--num];
+        weights[best] = weights[num];
+    }
+    free(values);
+    free(weights);
+    free(depth);
+}
@@ -0,0 +1,93 @@
+#pragma once
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "assembly.h"
+
+// $t0 - $t5 and $s0 - $s7 are handed out by the allocator.
+// $t6, $t7, $t8 and $t9 stay with allocReg for spilled variables and constants.
+// $t registers live across a call are saved by the caller, $s registers by the callee,
+// so variables live across calls prefer $s registers.
+#define ALLOC_REG_NUM 14
+// Larger functions fall back to linear scan, the interference matrix takes varNum^2 bits.
+#define COLOR_VAR_LIMIT 4096
+
+typedef struct _interval* pInterval;
+typedef struct _basicBlock* pBasicBlock;
+typedef struct _funcInfo* pFuncInfo;
+typedef struct _interGraph* pInterGraph;
+
+typedef struct _interval {
+    pOperand op; // the first operand with this name
+    int start, end; // positions of the first and the last code where the variable is live
+    int reg; // allocated register, -1 if spilled
+    boolean inMemory; // arrays and structures are always addressed through their slot
+    boolean crossesCall; // live across at least one call
+} Interval;
+
+typedef struct _basicBlock {
+    int first, last; // positions of the first and the last code
+    int succ[2];
+    int succNum;
+    unsigned *use, *def, *liveIn, *liveOut; // bit sets of variables
+} BasicBlock;
+
+typedef struct _funcInfo {
+    pInterCodes *codes; // codes of the function, indexed by position
+    int codeNum;
+    pAssemVarList varIndex; // variable name -> index of intervals
+    pInterval intervals;
+    int varNum, varCapacity;
+    pBasicBlock blocks;
+    int blockNum;
+    int *blockOf; // position -> block
+    int setWords; // words of a bit set
+    int callNum;
+    unsigned **callLive; // variables live across each call, in code order
+} FuncInfo;
+
+typedef struct _interGraph {
+    unsigned *matrix; // bit matrix of interference, varNum * varNum bits
+    int **adj; // adjacency lists
+    int *adjNum, *adjCapacity;
+    int *alias; // coalesced variables point to the variable that represents them
+    double *cost; // spill cost weighted by loop depth
+} InterGraph;
+
+extern const int ALLOC_REGS[ALLOC_REG_NUM];
+
+// Allocate registers for the function starting at func, registered variables are added to
+// varTable->varListAlloc, and the $t registers to save around each call go to varTable->callSaveMask.
+void allocateRegisters(pInterCodes func, pVarTable varTable);
+
+pFuncInfo newFuncInfo(pInterCodes func);
+void deleteFuncInfo(pFuncInfo info);
+int getVarNo(pFuncInfo info, pOperand op);
+int getDefUse(pInterCode code, pOperand *def, pOperand uses[]);
+void buildBlocks(pFuncInfo info);
+void computeLiveness(pFuncInfo info);
+void findCallCrossings(pFuncInfo info);
+void findAddressFolds(pFuncInfo info, pVarTable varTable);
+int pickRegister(const boolean *isFree, boolean crossesCall);
+void buildIntervals(pFuncInfo info);
+void linearScan(pFuncInfo info);
+int *computeLoopDepth(pFuncInfo info);
+// Spilled variables that are never live at the same time share a stack slot.
+void colorStackSlots(pFuncInfo info, pVarTable varTable);
+
+// Large constants used in loops go to the registers left over.
+boolean getLoopConstant(pInterCode code, int *value);
+void hoistConstants(pFuncInfo info, pVarTable varTable);
+
+// -O2: Chaitin-Briggs graph coloring with conservative coalescing.
+pInterGraph newInterGraph(pFuncInfo info);
+void deleteInterGraph(pFuncInfo info, pInterGraph graph);
+int getAlias(pInterGraph graph, int no);
+boolean isInterfering(pFuncInfo info, pInterGraph graph, int x, int y);
+void addInterference(pFuncInfo info, pInterGraph graph, int x, int y);
+void buildInterGraph(pFuncInfo info, pInterGraph graph);
+void computeSpillCost(pFuncInfo info, pInterGraph graph);
+boolean coalesceCopies(pFuncInfo info, pInterGraph graph);
+void colorGraph(pFuncInfo info, pInterGraph graph);
+
+#endif
@@ -0,0 +1,17 @@
+// read and write of the programs compiled with -x86, the same as the syscalls of the MIPS code:
+//   ./parser test.cmm test.s -x86 && gcc -o test test.s runtime/runtime.c
+#include <stdio.h>
+
+int cmm_read(void)
+{
+    int value = 0;
+    printf("Enter an integer:");
+    if (scanf("%d", &value) != 1)
+        return 0;
+    return value;
+}
+
+void cmm_write(int value)
+{
+    printf("%d\n", value);
+}
@@ -0,0 +1,351 @@
+#include "schedule.h"
+#include "assembly.h"
+
+// Defaults match a classic 5-stage pipeline with a multi-cycle multiplier and divider.
+LatencyModel latencyModel = {2, 5, 20};
+__thread SchedStats schedStats = {0, 0, 0, 0};
+
+static inline RegSet regBit(int regNo)
+{
+    return 1ull << regNo;
+}
+
+static inline boolean addReg(RegSet *set, const char *name)
+{
+    int regNo = getAssemRegNo(name);
+    if (regNo < 0)
+        return false;
+    *set |= regBit(regNo);
+    return true;
+}
+
+static inline boolean isOneOf(const char *op, const char *ops[], int num)
+{
+    for (int k = 0; k < num; k++)
+    {
+        if (!strcmp(op, ops[k]))
+            return true;
+    }
+    return false;
+}
+
+#define IS_ONE_OF(op, ops) isOneOf(op, ops, (int)(sizeof(ops) / sizeof(ops[0])))
+
+void scheduleBuffer(pAssemBuffer buffer)
+{
+    // A block runs from a label or a barrier to the next one, a jump or a call closes it
+    // and stays in the last place.
+    int first = 0;
+    for (int i = 0; i < buffer->num; i++)
+    {
+        pAssemInstr instr = &buffer->instrs[i];
+        if (isSchedBarrier(instr))
+        {
+            scheduleBlock(buffer, first, i);
+            first = i + 1;
+        }
+        else if (isBlockEnd(instr))
+        {
+            scheduleBlock(buffer, first, i + 1);
+            first = i + 1;
+        }
+    }
+    scheduleBlock(buffer, first, buffer->num);
+}
+
+void scheduleBlock(pAssemBuffer buffer, int first, int last)
+{
+    while (last - first > SCHED_WINDOW)
+    {
+        // Long blocks in windows, a block end can only be the last instruction.
+        scheduleBlock(buffer, first, first + SCHED_WINDOW);
+        first += SCHED_WINDOW;
+    }
+    int num = last - first;
+    if (num < 2)
+        return;
+    pAssemInstr instrs = &buffer->instrs[first];
+    boolean hasEnd = isBlockEnd(&instrs[num - 1]);
+
+    pSchedNode nodes = (pSchedNode)malloc(sizeof(SchedNode) * num);
+    int *edge = (int *)malloc(sizeof(int) * num * num); // edge[i * num + j]: j issues edge cycles after i, -1 if free
+    int *order = (int *)malloc(sizeof(int) * num);
+    boolean *done = (boolean *)malloc(sizeof(boolean) * num);
+    assert(nodes != nullptr && edge != nullptr && order != nullptr && done != nullptr);
+
+    int lastDef[REG_NUM + 1];
+    for (int r = 0; r <= REG_NUM; r++)
+        lastDef[r] = -1;
+    for (int i = 0; i < num; i++)
+    {
+        pSchedNode node = &nodes[i];
+        node->instr = &instrs[i];
+        node->use = node->def = 0;
+        getRegAccess(node->instr, &node->use, &node->def);
+        node->use &= ~regBit(ZERO);
+        node->def &= ~regBit(ZERO);
+        node->memBase = -1;
+        node->isStore = false;
+        const char *op = node->instr->op;
+        const char *memOps[] = {"lw", "lb", "lbu", "sw", "sb"};
+        if (IS_ONE_OF(op, memOps))
+        {
+            parseMemArg(node->instr->arg[1], &node->memOffset, &node->memBase);
+            node->memVersion = lastDef[node->memBase];
+            node->memWidth = op[1] == 'w' ? 4 : 1;
+            node->isStore = op[0] == 's';
+        }
+        for (int r = 0; r <= REG_NUM; r++)
+        {
+            if (node->def & regBit(r))
+                lastDef[r] = i;
+        }
+        node->latency = getInstrLatency(node->instr);
+        node->predNum = 0;
+        node->earliest = 0;
+        done[i] = false;
+    }
+
+    // Dependences: true ones wait for the latency, anti and output ones only keep the order.
+    for (int j = 0; j < num; j++)
+    {
+        for (int i = 0; i < j; i++)
+        {
+            int latency = -1;
+            if (nodes[i].def & nodes[j].use)
+                latency = nodes[i].latency;
+            if ((nodes[i].use & nodes[j].def) || (nodes[i].def & nodes[j].def) ||
+                isMemDependent(&nodes[i], &nodes[j]) || (hasEnd && j == num - 1))
+                latency = latency > 0 ? latency : 0;
+            edge[i * num + j] = latency;
+            if (latency >= 0)
+                nodes[j].predNum++;
+        }
+    }
+    for (int i = num - 1; i >= 0; i--)
+    {
+        nodes[i].height = nodes[i].latency;
+        for (int j = i + 1; j < num; j++)
+        {
+            if (edge[i * num + j] >= 0 && edge[i * num + j] + nodes[j].height > nodes[i].height)
+                nodes[i].height = edge[i * num + j] + nodes[j].height;
+        }
+    }
+
+    // List scheduling: among the ready instructions take one that issues without a stall,
+    // on the longest path first, in the original order on ties.
+    int cycle = 0;
+    for (int k = 0; k < num; k++)
+    {
+        int best = -1, bestStall = 0;
+        for (int i = 0; i < num; i++)
+        {
+            if (done[i] || nodes[i].predNum > 0)
+                continue;
+            int stall = nodes[i].earliest > cycle + 1 ? nodes[i].earliest - (cycle + 1) : 0;
+            if (best < 0 || stall < bestStall || (stall == bestStall && nodes[i].height > nodes[best].height))
+            {
+                best = i;
+                bestStall = stall;
+            }
+        }
+        assert(best >= 0);
+        done[best] = true;
+        order[k] = best;
+        cycle += 1 + bestStall;
+        for (int j = best + 1; j < num; j++)
+        {
+            int latency = edge[best * num + j];
+            if (latency < 0)
+                continue;
+            nodes[j].predNum--;
+            if (cycle + latency > nodes[j].earliest)
+                nodes[j].earliest = cycle + latency;
+        }
+    }
+
+    int stallsBefore = countStalls(instrs, num);
+    pAssemInstr scheduled = (pAssemInstr)malloc(sizeof(AssemInstr) * num);
+    assert(scheduled != nullptr);
+    int moved = 0;
+    for (int k = 0; k < num; k++)
+    {
+        scheduled[k] = instrs[order[k]];
+        if (order[k] != k)
+            moved++;
+    }
+    int stallsAfter = countStalls(scheduled, num);
+    // Keep the original order unless the new one is better.
+    if (stallsAfter < stallsBefore)
+    {
+        memcpy(instrs, scheduled, sizeof(AssemInstr) * num);
+        schedStats.moved += moved;
+    }
+    else
+        stallsAfter = stallsBefore;
+    schedStats.blocks++;
+    schedStats.stallsBefore += stallsBefore;
+    schedStats.stallsAfter += stallsAfter;
+
+    free(scheduled);
+    free(nodes);
+    free(edge);
+    free(order);
+    free(done);
+}
+
+int countStalls(pAssemInstr instrs, int num)
+{
+    // A result is ready getInstrLatency cycles after its instruction issues,
+    // the next instruction issues one cycle later unless it waits for a source.
+    int ready[REG_NUM + 1] = {0};
+    int cycle = 0, stalls = 0;
+    for (int i = 0; i < num; i++)
+    {
+        RegSet use = 0, def = 0;
+        getRegAccess(&instrs[i], &use, &def);
+        int issue = cycle + 1;
+        for (int r = 1; r <= REG_NUM; r++)
+        {
+            if ((use & regBit(r)) && ready[r] > issue)
+                issue = ready[r];
+        }
+        stalls += issue - (cycle + 1);
+        cycle = issue;
+        int latency = getInstrLatency(&instrs[i]);
+        for (int r = 1; r <= REG_NUM; r++)
+        {
+            if (def & regBit(r))
+                ready[r] = cycle + latency;
+        }
+    }
+    return stalls;
+}
+
+void printScheduleStats(FILE *fp)
+{
+    fprintf(fp, "schedule blocks: %d\n", schedStats.blocks);
+    fprintf(fp, "schedule moved: %d\n", schedStats.moved);
+    fprintf(fp, "schedule stalls: %d -> %d\n", schedStats.stallsBefore, schedStats.stallsAfter);
+}
+
+boolean isSchedBarrier(pAssemInstr instr)
+{
+    // Labels, text and instructions the scheduler does not know are never moved across.
+    RegSet use = 0, def = 0;
+    return instr->deleted || instr->kind != ASSEM_INSTR || !getRegAccess(instr, &use, &def);
+}
+
+boolean isBlockEnd(pAssemInstr instr)
+{
+    const char *ends[] = {"j", "jr", "jal", "jalr", "syscall"};
+    return instr->kind == ASSEM_INSTR && (isBranch(instr) || IS_ONE_OF(instr->op, ends));
+}
+
+boolean getRegAccess(pAssemInstr instr, RegSet *use, RegSet *def)
+{
+    // Registers read and written by instr, false if instr is unknown.
+    const char *binOps[] = {"add", "addu", "sub", "subu", "and", "or", "xor", "nor", "slt", "sltu",
+                            "sllv", "srlv", "srav", "mul", "seq", "sne", "sgt", "sge", "sle"};
+    const char *unOps[] = {"addi", "addiu", "andi", "ori", "xori", "slti", "sltiu", "sll", "srl", "sra",
+                           "move", "neg", "negu", "not", "abs"};
+    const char *constOps[] = {"li", "lui", "la"};
+    const char *loadOps[] = {"lw", "lb", "lbu"};
+    const char *storeOps[] = {"sw", "sb"};
+    const char *mulDivOps[] = {"mult", "multu", "div", "divu"};
+    const char *moveHiLoOps[] = {"mflo", "mfhi"};
+    const char *condOps[] = {"movn", "movz"};
+    const char *zeroBranches[] = {"beqz", "bnez", "bltz", "bgez", "blez", "bgtz", "jr", "jalr"};
+    const char *op = instr->op;
+    int offset, base;
+    if (IS_ONE_OF(op, binOps) && instr->argNum == 3)
+        return addReg(def, instr->arg[0]) && addReg(use, instr->arg[1]) &&
+               (instr->arg[2][0] != '$' || addReg(use, instr->arg[2]));
+    if (IS_ONE_OF(op, condOps) && instr->argNum == 3)
+        return addReg(def, instr->arg[0]) && addReg(use, instr->arg[0]) &&
+               addReg(use, instr->arg[1]) && addReg(use, instr->arg[2]);
+    if (IS_ONE_OF(op, unOps) && instr->argNum >= 2)
+        return addReg(def, instr->arg[0]) && addReg(use, instr->arg[1]);
+    if (IS_ONE_OF(op, constOps) && instr->argNum == 2)
+        return addReg(def, instr->arg[0]);
+    if (IS_ONE_OF(op, loadOps) && instr->argNum == 2 && parseMemArg(instr->arg[1], &offset, &base))
+    {
+        *use |= regBit(base);
+        return addReg(def, instr->arg[0]);
+    }
+    if (IS_ONE_OF(op, storeOps) && instr->argNum == 2 && parseMemArg(instr->arg[1], &offset, &base))
+    {
+        *use |= regBit(base);
+        return addReg(use, instr->arg[0]);
+    }
+    if (IS_ONE_OF(op, mulDivOps) && instr->argNum == 2)
+    {
+        *def |= regBit(HILO);
+        return addReg(use, instr->arg[0]) && addReg(use, instr->arg[1]);
+    }
+    if (IS_ONE_OF(op, moveHiLoOps) && instr->argNum == 1)
+    {
+        *use |= regBit(HILO);
+        return addReg(def, instr->arg[0]);
+    }
+    if (IS_ONE_OF(op, zeroBranches) && instr->argNum >= 1)
+        return addReg(use, instr->arg[0]);
+    if (isBranch(instr) && instr->argNum == 3)
+        return addReg(use, instr->arg[0]) && (instr->arg[1][0] != '$' || addReg(use, instr->arg[1]));
+    if (!strcmp(op, "j") || !strcmp(op, "b") || !strcmp(op, "nop"))
+        return true;
+    if (!strcmp(op, "jal"))
+    {
+        // Arguments and $sp go in, the caller-saved registers come back changed.
+        *use |= regBit(A0) | regBit(A1) | regBit(A2) | regBit(A3) | regBit(SP);
+        *def |= regBit(V0) | regBit(V1) | regBit(A0) | regBit(A1) | regBit(A2) | regBit(A3) | regBit(RA) | regBit(HILO);
+        for (int r = T0; r <= T7; r++)
+            *def |= regBit(r);
+        *def |= regBit(T8) | regBit(T9);
+        return true;
+    }
+    if (!strcmp(op, "syscall"))
+    {
+        *use |= regBit(V0) | regBit(A0);
+        *def |= regBit(V0);
+        return true;
+    }
+    return false;
+}
+
+boolean parseMemArg(const char *arg, int *offset, int *base)
+{
+    // offset(base)
+    const char *left = strchr(arg, '(');
+    if (left == nullptr)
+        return false;
+    char name[ASSEM_ARG_LEN];
+    int length = strcspn(left + 1, ")");
+    strncpy(name, left + 1, length);
+    name[length] = '\0';
+    *base = getAssemRegNo(name);
+    *offset = atoi(arg);
+    return *base >= 0;
+}
+
+int getInstrLatency(pAssemInstr instr)
+{
+    const char *op = instr->op;
+    if (!strcmp(op, "lw") || !strcmp(op, "lb") || !strcmp(op, "lbu"))
+        return latencyModel.load;
+    if (!strcmp(op, "mul") || !strcmp(op, "mult") || !strcmp(op, "multu"))
+        return latencyModel.mul;
+    if (!strcmp(op, "div") || !strcmp(op, "divu"))
+        return latencyModel.div;
+    return 1;
+}
+
+boolean isMemDependent(pSchedNode x, pSchedNode y)
+{
+    // Accesses through the same value of a base register touch known bytes, the others may alias.
+    if (x->memBase < 0 || y->memBase < 0 || (!x->isStore && !y->isStore))
+        return false;
+    if (x->memBase == y->memBase && x->memVersion == y->memVersion)
+        return x->memOffset < y->memOffset + y->memWidth && y->memOffset < x->memOffset + x->memWidth;
+    return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "peephole.h"
+
+// HI and LO are tracked as one register after the 32 general ones.
+#define HILO REG_NUM
+// Blocks longer than this are scheduled in pieces, the dependence matrix takes num^2 bytes.
+#define SCHED_WINDOW 256
+
+typedef unsigned long long RegSet;
+typedef struct _schedNode* pSchedNode;
+
+// Cycles from the issue of an instruction to the first use of its result without a stall.
+// The other instructions take 1 cycle.
+typedef struct _latencyModel {
+    int load; // lw, lb and lbu
+    int mul; // mul, and mult to mflo/mfhi
+    int div; // div to mflo/mfhi
+} LatencyModel;
+
+typedef struct _schedNode {
+    pAssemInstr instr;
+    RegSet use, def;
+    int memBase; // base register of a load or store, -1 if it does not access memory
+    int memVersion; // position of the last definition of memBase before the access
+    int memOffset, memWidth;
+    boolean isStore;
+    int latency;
+    int height; // longest latency path to the end of the block
+    int predNum; // unscheduled predecessors
+    int earliest; // first cycle it may issue without a stall
+} SchedNode;
+
+typedef struct _schedStats {
+    int blocks; // blocks scheduled
+    int moved; // instructions not in their original position
+    int stallsBefore, stallsAfter; // stalls inside the blocks estimated by countStalls
+} SchedStats;
+
+extern LatencyModel latencyModel;
+extern __thread SchedStats schedStats; // of the calling thread
+
+// Reorder the instructions of each basic block in buffer to hide the latencies.
+void scheduleBuffer(pAssemBuffer buffer);
+void scheduleBlock(pAssemBuffer buffer, int first, int last);
+// Stalls of a straight line of instructions on a single issue pipeline with latencyModel.
+int countStalls(pAssemInstr instrs, int num);
+void printScheduleStats(FILE* fp);
+
+// Helpers
+boolean isSchedBarrier(pAssemInstr instr);
+boolean isBlockEnd(pAssemInstr instr);
+boolean getRegAccess(pAssemInstr instr, RegSet* use, RegSet* def);
+boolean parseMemArg(const char* arg, int* offset, int* base);
+int getInstrLatency(pAssemInstr instr);
+boolean isMemDependent(pSchedNode x, pSchedNode y);
+
+#endif
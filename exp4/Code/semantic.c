@@ -251,7 +251,7 @@ pItem newItem(int symbolDepth, pFieldList pfield)
     p->icname = nullptr;
     p->symbolDepth = symbolDepth;
     p->field = pfield;
-    p->nextHash = p->prevHash = p->nextSymbol = nullptr;
+    p->nextHash = p->prevHash = p->nextSymbol = p->prevSymbol = nullptr;
     return p;
 }
 
@@ -351,6 +351,7 @@ pStack newStack()
     {
         p->stackArray[i] = nullptr;
     }
+    p->curStackDepth = 0;
     return p;
 }
 
@@ -728,6 +729,10 @@ pType Specifier(pNode node)
         {
             retType = newType(BASIC, charType);
         }
+        else if (!strcmp(child->val, "bool"))
+        {
+            retType = newType(BASIC, boolType);
+        }
         else if (!strcmp(child->val, "void"))
         {
             retType = newType(BASIC, voidType);
@@ -137,8 +137,8 @@ static inline unsigned int getHashCode(char* name) {
     unsigned int val = 0, i;
     for (; *name; ++name) {
         val = (val << 2) + *name;
-        if (i = val & ~HASH_TABLE_SIZE)
-            val = (val ^ (i >> 12)) & HASH_TABLE_SIZE;
+        if (i = val & ~(HASH_TABLE_SIZE - 1))
+            val = (val ^ (i >> 12)) & (HASH_TABLE_SIZE - 1);
     }
     return val;
 }
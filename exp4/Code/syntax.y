@@ -7,6 +7,9 @@
     /*Declare types*/
     #define YYSTYPE pNode 
 
+    /*DefList and StmtList are right recursive, allow long function bodies*/
+    #define YYMAXDEPTH 1000000
+
     /*Error flag*/
     extern int lexError;
     extern int syntaxError;
@@ -0,0 +1,75 @@
+#include "writer.h"
+
+pWriter newWriter(FILE *fp)
+{
+    assert(fp != nullptr);
+    pWriter p = (pWriter)malloc(sizeof(Writer));
+    assert(p != nullptr);
+    p->fp = fp;
+    p->buf = (char *)malloc(WRITER_BUF_SIZE);
+    assert(p->buf != nullptr);
+    p->pos = 0;
+    p->total = 0;
+    return p;
+}
+
+void deleteWriter(pWriter writer)
+{
+    assert(writer != nullptr);
+    flushWriter(writer);
+    fflush(writer->fp);
+    free(writer->buf);
+    free(writer);
+}
+
+void flushWriter(pWriter writer)
+{
+    if (writer->pos == 0)
+        return;
+    size_t n = fwrite(writer->buf, 1, writer->pos, writer->fp);
+    assert(n == (size_t)writer->pos);
+    writer->total += writer->pos;
+    writer->pos = 0;
+}
+
+void writeBytes(pWriter writer, const void *bytes, int len)
+{
+    if (writer->pos + len > WRITER_BUF_SIZE)
+    {
+        flushWriter(writer);
+        // Longer than the whole buffer, pass it on as it is.
+        if (len > WRITER_BUF_SIZE)
+        {
+            size_t n = fwrite(bytes, 1, len, writer->fp);
+            assert(n == (size_t)len);
+            writer->total += len;
+            return;
+        }
+    }
+    memcpy(writer->buf + writer->pos, bytes, len);
+    writer->pos += len;
+}
+
+void writeString(pWriter writer, const char *str)
+{
+    writeBytes(writer, str, strlen(str));
+}
+
+void writeInt(pWriter writer, int value)
+{
+    // Digits are produced backwards, unsigned so that INT_MIN negates safely.
+    char digits[12];
+    int num = 0;
+    unsigned int u = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do
+    {
+        digits[num++] = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+    if (value < 0)
+        digits[num++] = '-';
+    if (writer->pos + num > WRITER_BUF_SIZE)
+        flushWriter(writer);
+    while (num > 0)
+        writer->buf[writer->pos++] = digits[--num];
+}
@@ -0,0 +1,35 @@
+#pragma once
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "node.h"
+
+// Large enough that the C library passes each flush straight to one write.
+#define WRITER_BUF_SIZE 0x10000
+
+typedef struct _writer* pWriter;
+
+// Output is collected in buf and handed to fp only when buf is full or at the end,
+// the numbers are formatted by hand instead of through printf.
+typedef struct _writer {
+    FILE* fp;
+    char* buf;
+    int pos;
+    long long total; // bytes written so far
+} Writer;
+
+pWriter newWriter(FILE* fp);
+// Flushes what is left, fp is not closed.
+void deleteWriter(pWriter writer);
+void flushWriter(pWriter writer);
+void writeBytes(pWriter writer, const void* bytes, int len);
+void writeString(pWriter writer, const char* str);
+void writeInt(pWriter writer, int value);
+
+static inline void writeChar(pWriter writer, char c) {
+    if (writer->pos == WRITER_BUF_SIZE)
+        flushWriter(writer);
+    writer->buf[writer->pos++] = c;
+}
+
+#endif
@@ -0,0 +1,674 @@
+#include "x86.h"
+#include "optimize.h"
+
+const char *const X86_REG64[X86_ALLOC_REG_NUM + 1] = {
+    "%rbx", "%r12", "%r13", "%r14", "%r15", "%r10", "%r11", "%rax"};
+const char *const X86_REG32[X86_ALLOC_REG_NUM + 1] = {
+    "%ebx", "%r12d", "%r13d", "%r14d", "%r15d", "%r10d", "%r11d", "%eax"};
+const char *const X86_REG8[X86_ALLOC_REG_NUM + 1] = {
+    "%bl", "%r12b", "%r13b", "%r14b", "%r15b", "%r10b", "%r11b", "%al"};
+const char *const X86_ARG_REG64[X86_ARG_REG_NUM] = {
+    "%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+
+/*
+Every variable takes 64 bits. An int is kept sign-extended, so that IR_ADD_ADDR adds an
+offset to an address without knowing which operand is which, and IR_ASSIGN copies either.
+IR_ADD, IR_SUB, IR_MUL and IR_DIV compute in 32 bits and extend the result.
+*/
+void genX86Code(FILE *fp)
+{
+    pWriter writer = newWriter(fp);
+    writeString(writer, "  .text\n");
+    int regVarNum = 0, frameVarNum = 0;
+    pInterCodes func = interCodeList->head;
+    while (func != nullptr)
+    {
+        pX86Func f = newX86Func(writer, func);
+        func = translateX86Function(f);
+        regVarNum += f->regVarNum;
+        frameVarNum += f->varNum - f->regVarNum;
+        deleteX86Func(f);
+    }
+    writeString(writer, "  .section .note.GNU-stack,\"\",@progbits\n");
+    deleteWriter(writer);
+    if (printStats)
+        fprintf(stderr, "x86 variables in registers: %d, in the frame: %d\n", regVarNum, frameVarNum);
+}
+
+pX86Func newX86Func(pWriter writer, pInterCodes func)
+{
+    pX86Func f = (pX86Func)malloc(sizeof(X86Func));
+    assert(f != nullptr);
+    f->writer = writer;
+    f->info = newFuncInfo(func);
+    f->varNum = f->info->varNum;
+    f->reg = (int *)malloc((f->varNum + 1) * sizeof(int));
+    f->offset = (int *)calloc(f->varNum + 1, sizeof(int));
+    f->isArray = (boolean *)calloc(f->varNum + 1, sizeof(boolean));
+    assert(f->reg != nullptr && f->offset != nullptr && f->isArray != nullptr);
+    for (int no = 0; no < f->varNum; no++)
+        f->reg[no] = -1;
+    for (int i = 0; i < f->info->codeNum; i++)
+    {
+        pInterCode code = f->info->codes[i]->code;
+        if (code->kind == IR_DEC)
+            f->isArray[getX86VarNo(f, code->u.dec.op)] = true;
+    }
+    for (int k = 0; k < X86_SAVED_REG_NUM; k++)
+    {
+        f->isSaved[k] = false;
+        f->saveOffset[k] = 0;
+    }
+    f->frameSize = 0;
+    f->paramNo = 0;
+    f->regVarNum = 0;
+    if (optLevel >= 1)
+        allocateX86Registers(f);
+    layoutX86Frame(f);
+    return f;
+}
+
+void deleteX86Func(pX86Func f)
+{
+    assert(f != nullptr);
+    deleteFuncInfo(f->info);
+    free(f->reg);
+    free(f->offset);
+    free(f->isArray);
+    free(f);
+}
+
+static int compareWeight(const void *a, const void *b)
+{
+    pX86Candidate x = (pX86Candidate)a, y = (pX86Candidate)b;
+    if (x->weight != y->weight)
+        return x->weight < y->weight ? 1 : -1;
+    return x->no - y->no;
+}
+
+void allocateX86Registers(pX86Func f)
+{
+    /*
+    The intervals of regalloc.c, handed out by weight instead of by start: the most used
+    variable takes the first register where no variable with an overlapping interval is.
+    A register is shared only by intervals apart from each other.
+    */
+    pFuncInfo info = f->info;
+    buildBlocks(info);
+    computeLiveness(info);
+    buildIntervals(info);
+
+    // callsBefore[i]: codes before position i that call into C and clobber %r10 and %r11.
+    int *callsBefore = (int *)malloc((info->codeNum + 1) * sizeof(int));
+    assert(callsBefore != nullptr);
+    callsBefore[0] = 0;
+    for (int i = 0; i < info->codeNum; i++)
+        callsBefore[i + 1] = callsBefore[i] + isX86Call(info->codes[i]->code);
+
+    pX86Candidate candidates = (pX86Candidate)malloc((f->varNum + 1) * sizeof(X86Candidate));
+    assert(candidates != nullptr);
+    for (int no = 0; no < f->varNum; no++)
+    {
+        candidates[no].no = no;
+        candidates[no].weight = 0;
+    }
+    int *depth = computeLoopDepth(info);
+    pOperand def = nullptr, uses[3];
+    for (int i = 0; i < info->codeNum; i++)
+    {
+        double weight = 1;
+        for (int k = 0; k < depth[info->blockOf[i]] && k < 8; k++)
+            weight *= 10;
+        int useNum = getDefUse(info->codes[i]->code, &def, uses);
+        int no = getVarNo(info, def);
+        if (no >= 0)
+            candidates[no].weight += weight;
+        for (int k = 0; k < useNum; k++)
+        {
+            no = getVarNo(info, uses[k]);
+            if (no >= 0)
+                candidates[no].weight += weight;
+        }
+    }
+    free(depth);
+    qsort(candidates, f->varNum, sizeof(X86Candidate), compareWeight);
+
+    int *assigned[X86_ALLOC_REG_NUM], assignedNum[X86_ALLOC_REG_NUM];
+    for (int r = 0; r < X86_ALLOC_REG_NUM; r++)
+    {
+        assigned[r] = (int *)malloc((f->varNum + 1) * sizeof(int));
+        assert(assigned[r] != nullptr);
+        assignedNum[r] = 0;
+    }
+    for (int c = 0; c < f->varNum; c++)
+    {
+        int no = candidates[c].no;
+        pInterval interval = &info->intervals[no];
+        if (f->isArray[no] || interval->end < 0)
+            continue;
+        boolean crossesCall = callsBefore[interval->end] - callsBefore[interval->start + 1] > 0;
+        // %r10 and %r11 first for the others, so that fewer registers are saved.
+        for (int k = 0; k < X86_ALLOC_REG_NUM; k++)
+        {
+            int r = crossesCall ? k : (k + X86_SAVED_REG_NUM) % X86_ALLOC_REG_NUM;
+            if (crossesCall && r >= X86_SAVED_REG_NUM)
+                break;
+            boolean isFree = true;
+            for (int j = 0; j < assignedNum[r] && isFree; j++)
+            {
+                pInterval other = &info->intervals[assigned[r][j]];
+                isFree = other->end < interval->start || interval->end < other->start;
+            }
+            if (!isFree)
+                continue;
+            assigned[r][assignedNum[r]++] = no;
+            f->reg[no] = r;
+            f->regVarNum++;
+            if (r < X86_SAVED_REG_NUM)
+                f->isSaved[r] = true;
+            break;
+        }
+    }
+    for (int r = 0; r < X86_ALLOC_REG_NUM; r++)
+        free(assigned[r]);
+    free(candidates);
+    free(callsBefore);
+}
+
+void layoutX86Frame(pX86Func f)
+{
+    /*
+    From %rbp down: the callee-saved registers the function uses, a slot for each variable
+    not in a register, then the arrays. Parameters after the sixth stay where the caller
+    pushed them, from 16(%rbp) up.
+    */
+    int size = 0;
+    for (int k = 0; k < X86_SAVED_REG_NUM; k++)
+    {
+        if (f->isSaved[k])
+        {
+            size += 8;
+            f->saveOffset[k] = -size;
+        }
+    }
+    int paramNo = 0;
+    for (int i = 0; i < f->info->codeNum; i++)
+    {
+        pInterCode code = f->info->codes[i]->code;
+        if (code->kind != IR_PARAM)
+            continue;
+        int no = getX86VarNo(f, code->u.oneOp.op);
+        if (paramNo >= X86_ARG_REG_NUM && f->reg[no] < 0)
+            f->offset[no] = 16 + 8 * (paramNo - X86_ARG_REG_NUM);
+        paramNo++;
+    }
+    for (int no = 0; no < f->varNum; no++)
+    {
+        if (f->reg[no] >= 0 || f->isArray[no] || f->offset[no] != 0)
+            continue;
+        size += 8;
+        f->offset[no] = -size;
+    }
+    for (int i = 0; i < f->info->codeNum; i++)
+    {
+        pInterCode code = f->info->codes[i]->code;
+        if (code->kind != IR_DEC)
+            continue;
+        size += (code->u.dec.size + 7) & ~7;
+        f->offset[getX86VarNo(f, code->u.dec.op)] = -size;
+    }
+    f->frameSize = (size + 15) & ~15;
+}
+
+pInterCodes translateX86Function(pX86Func f)
+{
+    // Translate the function of f, returns the next function.
+    for (int i = 0; i < f->info->codeNum; i++)
+        translateX86Code(f, f->info->codes[i]);
+    return f->info->codes[f->info->codeNum - 1]->next;
+}
+
+void translateX86Code(pX86Func f, pInterCodes interCodes)
+{
+    pInterCode interCode = interCodes->code;
+    int kind = interCode->kind;
+    char buf1[X86_OPERAND_LEN], buf2[X86_OPERAND_LEN];
+    if (kind == IR_FUNCTION)
+    {
+        const char *name = interCode->u.oneOp.op->u.name;
+        if (!strcmp(name, "main"))
+            emitX86(f, "  .globl main\n");
+        emitX86(f, "\n%s:\n", name);
+        emitX86(f, "  pushq %%rbp\n");
+        emitX86(f, "  movq %%rsp, %%rbp\n");
+        if (f->frameSize > 0)
+            emitX86(f, "  subq $%d, %%rsp\n", f->frameSize);
+        for (int k = 0; k < X86_SAVED_REG_NUM; k++)
+        {
+            if (f->isSaved[k])
+                emitX86(f, "  movq %s, %d(%%rbp)\n", X86_REG64[k], f->saveOffset[k]);
+        }
+    }
+    else if (kind == IR_PARAM)
+    {
+        pOperand op = interCode->u.oneOp.op;
+        int paramNo = f->paramNo++;
+        int no = getX86VarNo(f, op);
+        if (paramNo < X86_ARG_REG_NUM)
+            emitX86(f, "  movq %s, %s\n", X86_ARG_REG64[paramNo], getX86Location(f, op, 8, buf1));
+        else if (f->reg[no] >= 0)
+            emitX86(f, "  movq %d(%%rbp), %s\n", 16 + 8 * (paramNo - X86_ARG_REG_NUM), X86_REG64[f->reg[no]]);
+    }
+    else if (kind == IR_LABEL)
+    {
+        emitX86(f, ".L%s:\n", interCode->u.oneOp.op->u.name);
+    }
+    else if (kind == IR_GOTO)
+    {
+        emitX86(f, "  jmp .L%s\n", interCode->u.oneOp.op->u.name);
+    }
+    else if (kind == IR_RETURN)
+    {
+        pOperand op = interCode->u.oneOp.op;
+        if (isX86Array(f, op))
+            loadX86Operand(f, op, "%rax");
+        else
+            emitX86(f, "  movl %s, %%eax\n", getX86Location(f, op, 4, buf1));
+        emitX86Epilogue(f);
+    }
+    else if (kind == IR_READ)
+    {
+        emitX86(f, "  call cmm_read\n");
+        storeX86Int(f, interCode->u.oneOp.op);
+    }
+    else if (kind == IR_WRITE)
+    {
+        pOperand op = interCode->u.oneOp.op;
+        if (isX86Array(f, op))
+            loadX86Operand(f, op, "%rdi");
+        else
+            emitX86(f, "  movl %s, %%edi\n", getX86Location(f, op, 4, buf1));
+        emitX86(f, "  call cmm_write\n");
+    }
+    else if (kind == IR_ARG || kind == IR_ARG_ADDR || kind == IR_DEC)
+    {
+        // IR_ARGs are handled inside call, IR_DEC in layoutX86Frame.
+    }
+    else if (kind == IR_CALL)
+    {
+        translateX86Call(f, interCodes);
+    }
+    else if (kind == IR_ASSIGN || kind == IR_GET_ADDR)
+    {
+        // The name of an array is its address already, &v of a parameter is its value.
+        pOperand left = interCode->u.assign.left, right = interCode->u.assign.right;
+        int dst = getX86Target(f, left);
+        if (right->kind == OP_CONSTANT || (!isX86Array(f, right) && (dst != X86_SCRATCH || !isX86Memory(f, right))))
+        {
+            const char *src = getX86Location(f, right, 8, buf1);
+            const char *to = getX86Location(f, left, 8, buf2);
+            if (strcmp(src, to))
+                emitX86(f, "  movq %s, %s\n", src, to);
+        }
+        else
+        {
+            loadX86Operand(f, right, X86_REG64[dst]);
+            storeX86Result(f, left, dst);
+        }
+    }
+    else if (kind == IR_READ_ADDR)
+    {
+        pOperand left = interCode->u.assign.left, right = interCode->u.assign.right;
+        const char *mem = getX86Address(f, right, buf1);
+        int dst = getX86Target(f, left);
+        const char *load = right->width == 1 ? (right->isUnsigned ? "movzbq" : "movsbq") : "movslq";
+        assert(right->width == 1 || right->width == 4);
+        emitX86(f, "  %s %s, %s\n", load, mem, X86_REG64[dst]);
+        storeX86Result(f, left, dst);
+    }
+    else if (kind == IR_WRITE_ADDR)
+    {
+        pOperand left = interCode->u.assign.left, right = interCode->u.assign.right;
+        boolean isByte = left->width == 1;
+        assert(left->width == 1 || left->width == 4);
+        // The address may take %rax, the value goes through %rcx.
+        const char *mem = getX86Address(f, left, buf1);
+        if (right->kind == OP_CONSTANT)
+            emitX86(f, "  %s $%d, %s\n", isByte ? "movb" : "movl", isByte ? right->u.value & 0xff : right->u.value, mem);
+        else if (!isX86Memory(f, right))
+        {
+            int reg = f->reg[getX86VarNo(f, right)];
+            emitX86(f, "  %s %s, %s\n", isByte ? "movb" : "movl", isByte ? X86_REG8[reg] : X86_REG32[reg], mem);
+        }
+        else
+        {
+            loadX86Operand(f, right, "%rcx");
+            emitX86(f, "  %s %s, %s\n", isByte ? "movb" : "movl", isByte ? "%cl" : "%ecx", mem);
+        }
+    }
+    else if (kind == IR_ADD || kind == IR_SUB || kind == IR_MUL)
+    {
+        pOperand result = interCode->u.binOp.result;
+        pOperand op1 = interCode->u.binOp.op1, op2 = interCode->u.binOp.op2;
+        int dst = getX86Target(f, result);
+        // Commutative: the constant or the operand already in dst goes first.
+        if (kind != IR_SUB && (op1->kind == OP_CONSTANT ||
+                               (op2->kind != OP_CONSTANT && !isX86Memory(f, op2) && f->reg[getX86VarNo(f, op2)] == dst)))
+        {
+            pOperand tmp = op1;
+            op1 = op2;
+            op2 = tmp;
+        }
+        // op2 is read after dst is written.
+        if (op2->kind != OP_CONSTANT && !isX86Memory(f, op2) && f->reg[getX86VarNo(f, op2)] == dst &&
+            (op1->kind == OP_CONSTANT || isX86Memory(f, op1) || f->reg[getX86VarNo(f, op1)] != dst))
+            dst = X86_SCRATCH;
+        const char *src1 = getX86Location(f, op1, 4, buf1);
+        const char *src2 = getX86Location(f, op2, 4, buf2);
+        if (kind == IR_MUL && op2->kind == OP_CONSTANT && op1->kind != OP_CONSTANT)
+            emitX86(f, "  imull %s, %s, %s\n", src2, src1, X86_REG32[dst]);
+        else
+        {
+            if (strcmp(src1, X86_REG32[dst]))
+                emitX86(f, "  movl %s, %s\n", src1, X86_REG32[dst]);
+            const char *instr = kind == IR_ADD ? "addl" : kind == IR_SUB ? "subl" : "imull";
+            emitX86(f, "  %s %s, %s\n", instr, src2, X86_REG32[dst]);
+        }
+        if (dst == X86_SCRATCH)
+            emitX86(f, "  cltq\n");
+        else
+            emitX86(f, "  movslq %s, %s\n", X86_REG32[dst], X86_REG64[dst]);
+        storeX86Result(f, result, dst);
+    }
+    else if (kind == IR_DIV)
+    {
+        pOperand result = interCode->u.binOp.result;
+        pOperand op1 = interCode->u.binOp.op1, op2 = interCode->u.binOp.op2;
+        emitX86(f, "  movl %s, %%eax\n", getX86Location(f, op1, 4, buf1));
+        emitX86(f, "  cltd\n");
+        if (op2->kind == OP_CONSTANT)
+        {
+            emitX86(f, "  movl $%d, %%ecx\n", op2->u.value);
+            emitX86(f, "  idivl %%ecx\n");
+        }
+        else
+            emitX86(f, "  idivl %s\n", getX86Location(f, op2, 4, buf2));
+        storeX86Int(f, result);
+    }
+    else if (kind == IR_ADD_ADDR)
+    {
+        pOperand result = interCode->u.binOp.result;
+        pOperand op1 = interCode->u.binOp.op1, op2 = interCode->u.binOp.op2;
+        int dst = getX86Target(f, result);
+        if (op1->kind == OP_CONSTANT || (op2->kind != OP_CONSTANT && !isX86Memory(f, op2) &&
+                                         f->reg[getX86VarNo(f, op2)] == dst))
+        {
+            pOperand tmp = op1;
+            op1 = op2;
+            op2 = tmp;
+        }
+        if (isX86Array(f, op1) && op2->kind == OP_CONSTANT)
+            emitX86(f, "  leaq %d(%%rbp), %s\n", f->offset[getX86VarNo(f, op1)] + op2->u.value, X86_REG64[dst]);
+        else
+        {
+            if (op2->kind != OP_CONSTANT && !isX86Memory(f, op2) && f->reg[getX86VarNo(f, op2)] == dst)
+                dst = X86_SCRATCH;
+            loadX86Operand(f, op1, X86_REG64[dst]);
+            if (isX86Array(f, op2))
+            {
+                loadX86Operand(f, op2, "%rcx");
+                emitX86(f, "  addq %%rcx, %s\n", X86_REG64[dst]);
+            }
+            else if (op2->kind != OP_CONSTANT || op2->u.value != 0)
+                emitX86(f, "  addq %s, %s\n", getX86Location(f, op2, 8, buf2), X86_REG64[dst]);
+        }
+        storeX86Result(f, result, dst);
+    }
+    else if (kind == IR_IF_GOTO)
+    {
+        pOperand x = interCode->u.ifGoto.x, y = interCode->u.ifGoto.y;
+        const char *relop = interCode->u.ifGoto.relop->u.name;
+        if (x->kind == OP_CONSTANT && y->kind != OP_CONSTANT)
+        {
+            pOperand tmp = x;
+            x = y;
+            y = tmp;
+            relop = getSwappedRelop(relop);
+        }
+        const char *src1 = getX86Location(f, x, 4, buf1);
+        const char *src2 = getX86Location(f, y, 4, buf2);
+        // cmpl takes at most one memory operand and no immediate on the right.
+        if (x->kind == OP_CONSTANT || (isX86Memory(f, x) && isX86Memory(f, y)))
+        {
+            emitX86(f, "  movl %s, %%eax\n", src1);
+            src1 = "%eax";
+        }
+        emitX86(f, "  cmpl %s, %s\n", src2, src1);
+        emitX86(f, "  %s .L%s\n", getX86Jump(relop), interCode->u.ifGoto.z->u.name);
+    }
+    else if (kind == IR_COPY)
+    {
+        // Both operands hold addresses, size is a multiple of 4.
+        int size = interCode->u.copy.size;
+        loadX86Operand(f, interCode->u.copy.src, "%rsi");
+        loadX86Operand(f, interCode->u.copy.dst, "%rdi");
+        if (size <= X86_COPY_UNROLL_BYTES)
+        {
+            int offset = 0;
+            for (; offset + 8 <= size; offset += 8)
+            {
+                emitX86(f, "  movq %d(%%rsi), %%rax\n", offset);
+                emitX86(f, "  movq %%rax, %d(%%rdi)\n", offset);
+            }
+            if (offset < size)
+            {
+                emitX86(f, "  movl %d(%%rsi), %%eax\n", offset);
+                emitX86(f, "  movl %%eax, %d(%%rdi)\n", offset);
+            }
+        }
+        else
+        {
+            emitX86(f, "  movl $%d, %%ecx\n", size);
+            emitX86(f, "  rep movsb\n");
+        }
+    }
+    else
+    {
+        assert(0);
+    }
+}
+
+void translateX86Call(pX86Func f, pInterCodes interCodes)
+{
+    pInterCode interCode = interCodes->code;
+    pOperand left = interCode->u.assign.left, right = interCode->u.assign.right;
+    pItem calledFunc = searchFirstTableItem(table, right->u.name + 2);
+    assert(calledFunc != nullptr);
+    int argc = calledFunc->field->type->u.func.argc;
+    // The IR_ARGs right before the call, the first argument is the nearest.
+    pOperand *args = (pOperand *)malloc((argc + 1) * sizeof(pOperand));
+    assert(args != nullptr);
+    pInterCodes arg = interCodes->prev;
+    for (int k = 0; k < argc; k++, arg = arg->prev)
+    {
+        assert(arg != nullptr && (arg->code->kind == IR_ARG || arg->code->kind == IR_ARG_ADDR));
+        args[k] = arg->code->u.oneOp.op;
+    }
+    // Pushed from the last one, %rsp stays 16-byte aligned at the call.
+    int stackNum = argc > X86_ARG_REG_NUM ? argc - X86_ARG_REG_NUM : 0;
+    int stackSize = 8 * (stackNum + stackNum % 2);
+    if (stackNum % 2 != 0)
+        emitX86(f, "  subq $8, %%rsp\n");
+    char buf[X86_OPERAND_LEN];
+    for (int k = argc - 1; k >= X86_ARG_REG_NUM; k--)
+    {
+        if (args[k]->kind == OP_ADDRESS || isX86Array(f, args[k]))
+        {
+            loadX86Argument(f, args[k], "%rax");
+            emitX86(f, "  pushq %%rax\n");
+        }
+        else
+            emitX86(f, "  pushq %s\n", getX86Location(f, args[k], 8, buf));
+    }
+    // The allocated registers are not argument registers, so loading one never clobbers another.
+    for (int k = 0; k < argc && k < X86_ARG_REG_NUM; k++)
+        loadX86Argument(f, args[k], X86_ARG_REG64[k]);
+    emitX86(f, "  call %s\n", right->u.name);
+    if (stackSize > 0)
+        emitX86(f, "  addq $%d, %%rsp\n", stackSize);
+    storeX86Int(f, left);
+    free(args);
+}
+
+void emitX86(pX86Func f, const char *format, ...)
+{
+    char line[X86_LINE_MAX];
+    va_list vaList;
+    va_start(vaList, format);
+    int len = vsnprintf(line, X86_LINE_MAX, format, vaList);
+    va_end(vaList);
+    assert(len >= 0 && len < X86_LINE_MAX);
+    writeBytes(f->writer, line, len);
+}
+
+int getX86VarNo(pX86Func f, pOperand op)
+{
+    // Every name of the function was numbered by newFuncInfo.
+    int no = getVarNo(f->info, op);
+    assert(no >= 0 && no < f->varNum);
+    return no;
+}
+
+boolean isX86Array(pX86Func f, pOperand op)
+{
+    return op->kind != OP_CONSTANT && f->isArray[getX86VarNo(f, op)];
+}
+
+boolean isX86Memory(pX86Func f, pOperand op)
+{
+    // In a frame slot, not in a register nor an immediate.
+    return op->kind != OP_CONSTANT && f->reg[getX86VarNo(f, op)] < 0;
+}
+
+const char *getX86Location(pX86Func f, pOperand op, int size, char *buf)
+{
+    // op as an operand of size bytes: an immediate, a register or a frame slot.
+    if (op->kind == OP_CONSTANT)
+    {
+        sprintf(buf, "$%d", op->u.value);
+        return buf;
+    }
+    int no = getX86VarNo(f, op);
+    assert(!f->isArray[no]);
+    int reg = f->reg[no];
+    if (reg >= 0)
+        return size == 8 ? X86_REG64[reg] : size == 4 ? X86_REG32[reg] : X86_REG8[reg];
+    sprintf(buf, "%d(%%rbp)", f->offset[no]);
+    return buf;
+}
+
+const char *getX86Address(pX86Func f, pOperand addr, char *buf)
+{
+    // The memory operand at the address held by addr, loaded into %rax if it is in a slot.
+    int no = getX86VarNo(f, addr);
+    if (f->isArray[no])
+        sprintf(buf, "%d(%%rbp)", f->offset[no]);
+    else if (f->reg[no] >= 0)
+        sprintf(buf, "(%s)", X86_REG64[f->reg[no]]);
+    else
+    {
+        emitX86(f, "  movq %d(%%rbp), %%rax\n", f->offset[no]);
+        sprintf(buf, "(%%rax)");
+    }
+    return buf;
+}
+
+int getX86Target(pX86Func f, pOperand op)
+{
+    // The register to put a new value of op in, %rax when op lives in the frame.
+    int reg = f->reg[getX86VarNo(f, op)];
+    return reg >= 0 ? reg : X86_SCRATCH;
+}
+
+void loadX86Operand(pX86Func f, pOperand op, const char *reg)
+{
+    // The 64-bit value of op into reg, the name of an array stands for its address.
+    char buf[X86_OPERAND_LEN];
+    if (isX86Array(f, op))
+        emitX86(f, "  leaq %d(%%rbp), %s\n", f->offset[getX86VarNo(f, op)], reg);
+    else
+    {
+        const char *src = getX86Location(f, op, 8, buf);
+        if (strcmp(src, reg))
+            emitX86(f, "  movq %s, %s\n", src, reg);
+    }
+}
+
+void loadX86Argument(pX86Func f, pOperand op, const char *reg)
+{
+    // An argument of kind OP_ADDRESS is passed as the value it points to.
+    if (op->kind != OP_ADDRESS)
+    {
+        loadX86Operand(f, op, reg);
+        return;
+    }
+    char buf[X86_OPERAND_LEN];
+    const char *mem = getX86Address(f, op, buf);
+    assert(op->width == 1 || op->width == 4);
+    const char *load = op->width == 1 ? (op->isUnsigned ? "movzbq" : "movsbq") : "movslq";
+    emitX86(f, "  %s %s, %s\n", load, mem, reg);
+}
+
+void storeX86Result(pX86Func f, pOperand op, int reg)
+{
+    // reg holds the new value of op, nothing to do when it is the register of op.
+    char buf[X86_OPERAND_LEN];
+    const char *dst = getX86Location(f, op, 8, buf);
+    if (strcmp(dst, X86_REG64[reg]))
+        emitX86(f, "  movq %s, %s\n", X86_REG64[reg], dst);
+}
+
+void storeX86Int(pX86Func f, pOperand op)
+{
+    // The int in %eax, from a call or a division, goes to op sign-extended.
+    int dst = getX86Target(f, op);
+    if (dst == X86_SCRATCH)
+        emitX86(f, "  cltq\n");
+    else
+        emitX86(f, "  movslq %%eax, %s\n", X86_REG64[dst]);
+    storeX86Result(f, op, dst);
+}
+
+void emitX86Epilogue(pX86Func f)
+{
+    for (int k = 0; k < X86_SAVED_REG_NUM; k++)
+    {
+        if (f->isSaved[k])
+            emitX86(f, "  movq %d(%%rbp), %s\n", f->saveOffset[k], X86_REG64[k]);
+    }
+    emitX86(f, "  leave\n");
+    emitX86(f, "  ret\n");
+}
+
+const char *getX86Jump(const char *relop)
+{
+    // The jump taken when x relop y holds after cmpl y, x.
+    if (!strcmp(relop, "=="))
+        return "je";
+    if (!strcmp(relop, "!="))
+        return "jne";
+    if (!strcmp(relop, "<"))
+        return "jl";
+    if (!strcmp(relop, ">"))
+        return "jg";
+    if (!strcmp(relop, "<="))
+        return "jle";
+    assert(!strcmp(relop, ">="));
+    return "jge";
+}
+
+boolean isX86Call(pInterCode code)
+{
+    // read and write call into the runtime, the same as a call of a function.
+    return code->kind == IR_CALL || code->kind == IR_READ || code->kind == IR_WRITE;
+}
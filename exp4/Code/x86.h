@@ -0,0 +1,78 @@
+#pragma once
+#ifndef X86_H
+#define X86_H
+
+#include <stdarg.h>
+#include "regalloc.h"
+
+// Registers handed out by the allocator. %rbx and %r12 - %r15 are saved by the callee and keep
+// their value across calls, %r10 and %r11 only hold variables not live across a call, read or write.
+#define X86_ALLOC_REG_NUM 7
+#define X86_SAVED_REG_NUM 5
+// %rax after the allocated registers, the scratch register of most codes.
+#define X86_SCRATCH X86_ALLOC_REG_NUM
+
+// The first arguments are passed in %rdi, %rsi, %rdx, %rcx, %r8 and %r9, the others in the stack.
+#define X86_ARG_REG_NUM 6
+
+// Struct copies up to this many bytes are unrolled, larger ones use rep movsb.
+#define X86_COPY_UNROLL_BYTES 64
+
+#define X86_LINE_MAX 128
+#define X86_OPERAND_LEN 32
+
+typedef struct _x86Func* pX86Func;
+typedef struct _x86Candidate* pX86Candidate;
+
+// The function being translated and where each of its variables lives.
+typedef struct _x86Func {
+    pWriter writer;
+    pFuncInfo info; // variables numbered by getVarNo
+    int varNum;
+    int *reg; // allocated register of each variable, -1 if it lives in the frame
+    int *offset; // slot of each variable from %rbp, or the base of an array
+    boolean *isArray; // declared by DEC, the name stands for its address
+    boolean isSaved[X86_SAVED_REG_NUM]; // callee-saved registers used by the function
+    int saveOffset[X86_SAVED_REG_NUM];
+    int frameSize; // %rsp is moved once by frameSize in the prologue, a multiple of 16
+    int paramNo; // PARAMs translated so far
+    int regVarNum; // variables kept in registers
+} X86Func;
+
+typedef struct _x86Candidate {
+    int no;
+    double weight; // uses and definitions weighted by 10^loop depth
+} X86Candidate;
+
+extern const char *const X86_REG64[X86_ALLOC_REG_NUM + 1];
+extern const char *const X86_REG32[X86_ALLOC_REG_NUM + 1];
+extern const char *const X86_REG8[X86_ALLOC_REG_NUM + 1];
+extern const char *const X86_ARG_REG64[X86_ARG_REG_NUM];
+
+// -x86: x86-64 assembly for the GNU assembler, linked with runtime/runtime.c for read and write.
+void genX86Code(FILE* fp);
+pX86Func newX86Func(pWriter writer, pInterCodes func);
+void deleteX86Func(pX86Func f);
+void allocateX86Registers(pX86Func f);
+void layoutX86Frame(pX86Func f);
+pInterCodes translateX86Function(pX86Func f);
+void translateX86Code(pX86Func f, pInterCodes interCodes);
+void translateX86Call(pX86Func f, pInterCodes interCodes);
+
+// Helpers
+void emitX86(pX86Func f, const char* format, ...);
+int getX86VarNo(pX86Func f, pOperand op);
+boolean isX86Array(pX86Func f, pOperand op);
+boolean isX86Memory(pX86Func f, pOperand op);
+const char *getX86Location(pX86Func f, pOperand op, int size, char* buf);
+const char *getX86Address(pX86Func f, pOperand addr, char* buf);
+int getX86Target(pX86Func f, pOperand op);
+void loadX86Operand(pX86Func f, pOperand op, const char* reg);
+void loadX86Argument(pX86Func f, pOperand op, const char* reg);
+void storeX86Result(pX86Func f, pOperand op, int reg);
+void storeX86Int(pX86Func f, pOperand op);
+void emitX86Epilogue(pX86Func f);
+const char *getX86Jump(const char* relop);
+boolean isX86Call(pInterCode code);
+
+#endif
@@ -130,6 +130,11 @@ extern void IR_block_print(IR_block *block, FILE *out);
 extern void IR_function_print(IR_function *func, FILE *out);
 extern void IR_program_print(IR_program *program, FILE *out);
 
+// 输出为 C 代码, 每个 IR_function 对应一个 C 函数, 可用 gcc -O2 编译后原生运行
+extern void IR_output_c(const char *output_C_path);
+extern void IR_function_print_c(IR_function *func, FILE *out);
+extern void IR_program_print_c(IR_program *program, FILE *out);
+
 //// ================================== Stmt ==================================
 
 typedef enum {
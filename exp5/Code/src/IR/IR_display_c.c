@@ -0,0 +1,244 @@
+//
+// IR -> C, 每个 IR_function 输出为一个 C 函数, 用 gcc -O2 编译后即可原生运行
+//
+
+#include <IR.h>
+#include <stdio.h>
+#include <limits.h>
+
+DEF_SET(IR_var)
+
+//// =============================== C prelude ===============================
+
+// 所有值都是 int, 与 IR 一致. DEC 数组分配在 ir_mem 上, 地址是 ir_mem 中的下标,
+// 因此地址运算仍是 int 运算; + - * 按 32 位回绕, 与 MIPS 上的结果相同.
+static const char *IR_C_prelude =
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "#define IR_MEM_SIZE (1 << 24)\n"
+    "static unsigned char ir_mem[IR_MEM_SIZE];\n"
+    "static int ir_sp = IR_MEM_SIZE;\n"
+    "\n"
+    "static inline int ir_alloc(int size) {\n"
+    "    ir_sp -= size;\n"
+    "    if(ir_sp < 0) {\n"
+    "        fprintf(stderr, \"DEC stack overflow\\n\");\n"
+    "        exit(1);\n"
+    "    }\n"
+    "    return ir_sp;\n"
+    "}\n"
+    "static inline int ir_load(int addr) { int val; memcpy(&val, ir_mem + addr, sizeof(val)); return val; }\n"
+    "static inline void ir_store(int addr, int val) { memcpy(ir_mem + addr, &val, sizeof(val)); }\n"
+    "static inline int ir_add(int a, int b) { return (int)((unsigned)a + (unsigned)b); }\n"
+    "static inline int ir_sub(int a, int b) { return (int)((unsigned)a - (unsigned)b); }\n"
+    "static inline int ir_mul(int a, int b) { return (int)((unsigned)a * (unsigned)b); }\n"
+    "static inline int ir_div(int a, int b) { return b == -1 ? ir_sub(0, a) : a / b; }\n"
+    "static inline int ir_read(void) { int val = 0; if(scanf(\"%d\", &val) != 1) return 0; return val; }\n"
+    "static inline void ir_write(int val) { printf(\"%d\\n\", val); }\n"
+    "\n";
+
+//// =============================== C print ===============================
+
+static void IR_val_print_c(IR_val val, FILE *out) {
+    if(!val.is_const)
+        fprintf(out, "v%u", val.var);
+    else if(val.const_val == INT_MIN) // -2147483648 不是 int 字面量
+        fprintf(out, "(%d - 1)", INT_MIN + 1);
+    else
+        fprintf(out, "%d", val.const_val);
+}
+
+static void IR_func_name_print_c(const char *func_name, FILE *out) {
+    // main 仍是程序入口, 其余函数加前缀, 避免与 C 库函数重名
+    if(!strcmp(func_name, "main"))
+        fprintf(out, "main");
+    else
+        fprintf(out, "f_%s", func_name);
+}
+
+static void IR_stmt_print_c(IR_stmt *stmt, bool has_dec, FILE *out) {
+    switch (stmt->stmt_type) {
+        case IR_OP_STMT: {
+            IR_op_stmt *op_stmt = (IR_op_stmt*)stmt;
+            static const char *op_func[] = {
+                    [IR_OP_ADD] = "ir_add", [IR_OP_SUB] = "ir_sub",
+                    [IR_OP_MUL] = "ir_mul", [IR_OP_DIV] = "ir_div"};
+            fprintf(out, "    v%u = %s(", op_stmt->rd, op_func[op_stmt->op]);
+            IR_val_print_c(op_stmt->rs1, out);
+            fprintf(out, ", ");
+            IR_val_print_c(op_stmt->rs2, out);
+            fprintf(out, ");\n");
+            break;
+        }
+        case IR_ASSIGN_STMT: {
+            IR_assign_stmt *assign_stmt = (IR_assign_stmt*)stmt;
+            fprintf(out, "    v%u = ", assign_stmt->rd);
+            IR_val_print_c(assign_stmt->rs, out);
+            fprintf(out, ";\n");
+            break;
+        }
+        case IR_LOAD_STMT: {
+            IR_load_stmt *load_stmt = (IR_load_stmt*)stmt;
+            fprintf(out, "    v%u = ir_load(", load_stmt->rd);
+            IR_val_print_c(load_stmt->rs_addr, out);
+            fprintf(out, ");\n");
+            break;
+        }
+        case IR_STORE_STMT: {
+            IR_store_stmt *store_stmt = (IR_store_stmt*)stmt;
+            fprintf(out, "    ir_store(");
+            IR_val_print_c(store_stmt->rd_addr, out);
+            fprintf(out, ", ");
+            IR_val_print_c(store_stmt->rs, out);
+            fprintf(out, ");\n");
+            break;
+        }
+        case IR_IF_STMT: {
+            IR_if_stmt *if_stmt = (IR_if_stmt*)stmt;
+            static const char *relop_str[] = {
+                    [IR_RELOP_EQ] = "==", [IR_RELOP_NE] = "!=", [IR_RELOP_GT] = ">",
+                    [IR_RELOP_GE] = ">=", [IR_RELOP_LT] = "<", [IR_RELOP_LE] = "<="};
+            fprintf(out, "    if(");
+            IR_val_print_c(if_stmt->rs1, out);
+            fprintf(out, " %s ", relop_str[if_stmt->relop]);
+            IR_val_print_c(if_stmt->rs2, out);
+            fprintf(out, ") goto L%u;\n", if_stmt->true_label);
+            if(if_stmt->false_label != IR_LABEL_NONE)
+                fprintf(out, "    goto L%u;\n", if_stmt->false_label);
+            break;
+        }
+        case IR_GOTO_STMT: {
+            IR_goto_stmt *goto_stmt = (IR_goto_stmt*)stmt;
+            if(goto_stmt->label != IR_LABEL_NONE)
+                fprintf(out, "    goto L%u;\n", goto_stmt->label);
+            break;
+        }
+        case IR_CALL_STMT: {
+            // ARG 按实参的逆序出现, argv[argc - 1] 是第一个实参
+            IR_call_stmt *call_stmt = (IR_call_stmt*)stmt;
+            fprintf(out, "    v%u = ", call_stmt->rd);
+            IR_func_name_print_c(call_stmt->func_name, out);
+            fprintf(out, "(");
+            for(unsigned i = call_stmt->argc; i != 0; i --) {
+                IR_val_print_c(call_stmt->argv[i - 1], out);
+                if(i != 1)
+                    fprintf(out, ", ");
+            }
+            fprintf(out, ");\n");
+            break;
+        }
+        case IR_RETURN_STMT: {
+            IR_return_stmt *return_stmt = (IR_return_stmt*)stmt;
+            if(has_dec)
+                fprintf(out, "    ir_sp = ir_frame;\n");
+            fprintf(out, "    return ");
+            IR_val_print_c(return_stmt->rs, out);
+            fprintf(out, ";\n");
+            break;
+        }
+        case IR_READ_STMT: {
+            IR_read_stmt *read_stmt = (IR_read_stmt*)stmt;
+            fprintf(out, "    v%u = ir_read();\n", read_stmt->rd);
+            break;
+        }
+        case IR_WRITE_STMT: {
+            IR_write_stmt *write_stmt = (IR_write_stmt*)stmt;
+            fprintf(out, "    ir_write(");
+            IR_val_print_c(write_stmt->rs, out);
+            fprintf(out, ");\n");
+            break;
+        }
+        default: assert(0);
+    }
+}
+
+static void IR_function_print_c_head(IR_function *func, FILE *out) {
+    bool is_main = !strcmp(func->func_name, "main");
+    fprintf(out, "%sint ", is_main ? "" : "static ");
+    IR_func_name_print_c(func->func_name, out);
+    fprintf(out, "(");
+    if(func->params.len == 0)
+        fprintf(out, "void");
+    for(unsigned i = 0; i < func->params.len; i ++)
+        fprintf(out, "%sint v%u", i ? ", " : "", func->params.arr[i]);
+    fprintf(out, ")");
+}
+
+void IR_function_print_c(IR_function *func, FILE *out) {
+    // 除参数外, 函数中出现的变量都声明为局部变量, 初值为 0
+    Set_IR_var vars;
+    Set_IR_var_init(&vars);
+    for_map(IR_var, IR_Dec, it, func->map_dec)
+        VCALL(vars, insert, it->val.dec_addr);
+    for_list(IR_block_ptr, i, func->blocks) {
+        for_list(IR_stmt_ptr, j, i->val->stmts) {
+            IR_stmt *stmt = j->val;
+            IR_var def = VCALL(*stmt, get_def);
+            IR_use use = VCALL(*stmt, get_use_vec);
+            if(def != IR_VAR_NONE)
+                VCALL(vars, insert, def);
+            for(unsigned k = 0; k < use.use_cnt; k ++)
+                if(!use.use_vec[k].is_const)
+                    VCALL(vars, insert, use.use_vec[k].var);
+        }
+    }
+    for_vec(IR_var, var, func->params)
+        VCALL(vars, delete, *var);
+
+    IR_function_print_c_head(func, out);
+    fprintf(out, " {\n");
+    for_set(IR_var, var, vars)
+        fprintf(out, "    int v%u = 0;\n", var->key);
+    Set_IR_var_teardown(&vars);
+    // DEC 数组在函数入口分配, 每个 RETURN 前释放
+    bool has_dec = func->map_dec.root != NULL;
+    if(has_dec)
+        fprintf(out, "    int ir_frame = ir_sp;\n");
+    for_map(IR_var, IR_Dec, it, func->map_dec)
+        fprintf(out, "    v%u = ir_alloc(%u);\n", it->val.dec_addr, (it->val.dec_size + 3) & ~3u);
+    for_list(IR_block_ptr, i, func->blocks) {
+        IR_block *blk = i->val;
+        if(blk->label != IR_LABEL_NONE)
+            fprintf(out, "L%u:;\n", blk->label);
+        for_list(IR_stmt_ptr, j, blk->stmts)
+            IR_stmt_print_c(j->val, has_dec, out);
+    }
+    if(has_dec)
+        fprintf(out, "    ir_sp = ir_frame;\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n\n");
+}
+
+void IR_program_print_c(IR_program *program, FILE *out) {
+    fprintf(out, "%s", IR_C_prelude);
+    // 函数可以调用在它之后定义的函数
+    for_vec(IR_function *, func_ptr_ptr, program->functions) {
+        IR_function *func = *func_ptr_ptr;
+        if(!strcmp(func->func_name, "main"))
+            continue;
+        IR_function_print_c_head(func, out);
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "\n");
+    for_vec(IR_function *, func_ptr_ptr, program->functions) {
+        IR_function *func = *func_ptr_ptr;
+        IR_function_print_c(func, out);
+    }
+}
+
+void IR_output_c(const char *output_C_path) {
+    assert(ir_program_global != NULL);
+    FILE *c_file = stdout;
+    if(output_C_path) {
+        c_file = fopen(output_C_path, "w");
+        if(!c_file) {
+            perror(output_C_path);
+            exit(1);
+        }
+    }
+    IR_program_print_c(ir_program_global, c_file);
+    if(c_file != stdout)
+        fclose(c_file);
+}
@@ -5,9 +5,14 @@
 
 int main(int argc, char *argv[]) {
     srand(time(NULL));
+    // parser [input.ir] [output.ir] [optimized.c] [unoptimized.c]
     IR_parse(argc >= 2 ? argv[1] : NULL);
+    if(argc >= 5)
+        IR_output_c(argv[4]);
     IR_optimize();
     IR_output(argc >= 3 ? argv[2] : NULL);
+    if(argc >= 4)
+        IR_output_c(argv[3]);
     if(ir_program_global != NULL)
         RDELETE(IR_program, ir_program_global);
     return 0;